@@ -3,7 +3,35 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Most sectors that adjacent requests are merged into. */
+#define BLOCK_MERGE_MAX 128
+
+/* Number of buckets in a latency histogram.  Bucket 0 counts
+   latencies under 1 us, bucket I > 0 those from 2**(I-1) us up
+   to 2**I us, and the last bucket everything longer. */
+#define BLOCK_HIST_BUCKETS 24
+
+/* Number of recent requests each device traces, if enabled. */
+#define BLOCK_TRACE_SIZE 64
+
+/* A completed request, as recorded in a device's trace. */
+struct block_trace_entry
+  {
+    block_sector_t sector;              /* First sector. */
+    block_sector_t cnt;                 /* Number of sectors. */
+    bool write;                         /* Write (true) or read (false)? */
+    int64_t submit_time;                /* When submitted, in us. */
+    int64_t issue_time;                 /* When issued to driver. */
+    int64_t complete_time;              /* When completed. */
+  };
+
+/* If true, devices keep traces of their recent requests. */
+bool block_trace;
 
 /* A block device. */
 struct block
@@ -19,6 +47,27 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+
+    /* Request queue, served by the device's worker thread.
+       Unused, and there is no worker, if OPS->SUBMIT is
+       non-null. */
+    struct lock queue_lock;             /* Protects the members below. */
+    struct list queue;                  /* Pending requests, by sector. */
+    struct condition queue_nonempty;    /* Signaled when queue grows. */
+    block_sector_t head;                /* Sector after last one issued. */
+
+    /* Request statistics, protected by queue_lock. */
+    unsigned long long request_cnt;     /* Requests completed. */
+    unsigned long long merge_cnt;       /* Requests merged into others. */
+    int in_flight;                      /* Requests submitted, not done. */
+    int max_in_flight;                  /* Most ever in flight at once. */
+    unsigned queue_hist[BLOCK_HIST_BUCKETS];    /* Submit to issue. */
+    unsigned service_hist[BLOCK_HIST_BUCKETS];  /* Issue to completion. */
+
+    /* Ring of recent requests, or a null pointer if tracing is
+       off, also protected by queue_lock. */
+    struct block_trace_entry *trace;
+    unsigned long long trace_cnt;       /* Requests ever traced. */
   };
 
 /* List of all block devices. */
@@ -28,6 +77,7 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static thread_func block_worker NO_RETURN;
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -113,6 +163,329 @@ check_sector (struct block *block, block_sector_t sector)
     }
 }
 
+/* Verifies that the CNT sectors starting at SECTOR are all
+   within BLOCK.  Panics if not. */
+static void
+check_sectors (struct block *block, block_sector_t sector,
+               block_sector_t cnt)
+{
+  if (cnt > 0)
+    {
+      check_sector (block, sector);
+      if (cnt > block->size - sector)
+        PANIC ("Access past end of device %s (sector=%"PRDSNu", "
+               "cnt=%"PRDSNu", size=%"PRDSNu")\n",
+               block_name (block), sector, cnt, block->size);
+    }
+}
+
+/* Has BLOCK's driver transfer the CNT sectors starting at
+   SECTOR to or from BUFFER, in one call if the driver can. */
+static void
+transfer (struct block *block, block_sector_t sector, block_sector_t cnt,
+          void *buffer, bool write)
+{
+  uint8_t *p = buffer;
+  block_sector_t i;
+
+  if (write)
+    {
+      if (block->ops->write_multiple != NULL)
+        block->ops->write_multiple (block->aux, sector, cnt, buffer);
+      else
+        for (i = 0; i < cnt; i++)
+          block->ops->write (block->aux, sector + i,
+                             p + i * BLOCK_SECTOR_SIZE);
+      block->write_cnt += cnt;
+    }
+  else
+    {
+      if (block->ops->read_multiple != NULL)
+        block->ops->read_multiple (block->aux, sector, cnt, buffer);
+      else
+        for (i = 0; i < cnt; i++)
+          block->ops->read (block->aux, sector + i,
+                            p + i * BLOCK_SECTOR_SIZE);
+      block->read_cnt += cnt;
+    }
+}
+
+/* Returns true if request A starts at a lower sector than B. */
+static bool
+request_less (struct list_elem *a_, struct list_elem *b_, void *aux UNUSED)
+{
+  struct block_request *a = list_entry (a_, struct block_request, elem);
+  struct block_request *b = list_entry (b_, struct block_request, elem);
+  return a->sector < b->sector;
+}
+
+/* Moves the next requests to issue from BLOCK's queue to BATCH.
+   The queue is served in C-LOOK order: the first request is the
+   lowest-numbered one at or past the sector where the last
+   request ended, or failing that, the lowest-numbered one
+   overall, so that the disk sweeps upward and then jumps back.
+   Queued requests in the same direction that continue where the
+   first one ends are merged onto it, up to BLOCK_MERGE_MAX
+   sectors in all.  BLOCK's queue_lock must be held. */
+static void
+next_batch (struct block *block, struct list *batch)
+{
+  struct list_elem *e;
+  struct block_request *first, *last;
+  block_sector_t cnt;
+
+  ASSERT (!list_empty (&block->queue));
+
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    if (list_entry (e, struct block_request, elem)->sector >= block->head)
+      break;
+  if (e == list_end (&block->queue))
+    e = list_begin (&block->queue);
+
+  first = last = list_entry (e, struct block_request, elem);
+  cnt = first->cnt;
+  e = list_remove (e);
+  list_push_back (batch, &first->elem);
+
+  while (e != list_end (&block->queue))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->sector != last->sector + last->cnt || r->write != first->write
+          || cnt + r->cnt > BLOCK_MERGE_MAX)
+        break;
+      e = list_remove (e);
+      list_push_back (batch, &r->elem);
+      cnt += r->cnt;
+      last = r;
+    }
+  block->head = last->sector + last->cnt;
+}
+
+/* Adds a latency of USECS microseconds to histogram HIST. */
+static void
+hist_add (unsigned hist[BLOCK_HIST_BUCKETS], int64_t usecs)
+{
+  int bucket = 0;
+
+  while (usecs > 0 && bucket < BLOCK_HIST_BUCKETS - 1)
+    {
+      usecs >>= 1;
+      bucket++;
+    }
+  hist[bucket]++;
+}
+
+/* Records in BLOCK's statistics and trace that request R
+   completed at time END.  BLOCK's queue_lock must be held. */
+static void
+account (struct block *block, struct block_request *r, int64_t end)
+{
+  block->request_cnt++;
+  block->in_flight--;
+  hist_add (block->queue_hist, r->issue_time - r->submit_time);
+  hist_add (block->service_hist, end - r->issue_time);
+
+  if (block->trace != NULL)
+    {
+      struct block_trace_entry *t;
+
+      t = &block->trace[block->trace_cnt++ % BLOCK_TRACE_SIZE];
+      t->sector = r->sector;
+      t->cnt = r->cnt;
+      t->write = r->write;
+      t->submit_time = r->submit_time;
+      t->issue_time = r->issue_time;
+      t->complete_time = end;
+    }
+}
+
+/* Issues the requests in BATCH, which cover consecutive sectors
+   in one direction, to BLOCK's driver and completes them.  A
+   batch of more than one request goes to the driver as a single
+   transfer through a bounce buffer, if one can be allocated. */
+static void
+issue_batch (struct block *block, struct list *batch)
+{
+  struct block_request *first = list_entry (list_front (batch),
+                                            struct block_request, elem);
+  struct list_elem *e;
+  block_sector_t cnt = 0;
+  uint8_t *bounce = NULL;
+  int64_t now;
+
+  now = timer_usecs ();
+  for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+    list_entry (e, struct block_request, elem)->issue_time = now;
+
+  if (list_begin (batch) != list_rbegin (batch))
+    {
+      for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+        cnt += list_entry (e, struct block_request, elem)->cnt;
+      bounce = malloc (cnt * BLOCK_SECTOR_SIZE);
+    }
+
+  if (bounce != NULL)
+    {
+      uint8_t *p;
+
+      if (first->write)
+        for (p = bounce, e = list_begin (batch); e != list_end (batch);
+             e = list_next (e))
+          {
+            struct block_request *r = list_entry (e, struct block_request,
+                                                  elem);
+            memcpy (p, r->buffer, r->cnt * BLOCK_SECTOR_SIZE);
+            p += r->cnt * BLOCK_SECTOR_SIZE;
+          }
+      transfer (block, first->sector, cnt, bounce, first->write);
+      if (!first->write)
+        for (p = bounce, e = list_begin (batch); e != list_end (batch);
+             e = list_next (e))
+          {
+            struct block_request *r = list_entry (e, struct block_request,
+                                                  elem);
+            memcpy (r->buffer, p, r->cnt * BLOCK_SECTOR_SIZE);
+            p += r->cnt * BLOCK_SECTOR_SIZE;
+          }
+      free (bounce);
+    }
+  else
+    for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+      {
+        struct block_request *r = list_entry (e, struct block_request, elem);
+        r->issue_time = timer_usecs ();
+        transfer (block, r->sector, r->cnt, r->buffer, r->write);
+      }
+
+  now = timer_usecs ();
+  lock_acquire (&block->queue_lock);
+  if (bounce != NULL)
+    block->merge_cnt += list_size (batch) - 1;
+  for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+    account (block, list_entry (e, struct block_request, elem), now);
+  lock_release (&block->queue_lock);
+
+  /* A completed request may be freed at once, so take each off
+     the list before completing it. */
+  while (!list_empty (batch))
+    {
+      struct block_request *r = list_entry (list_pop_front (batch),
+                                            struct block_request, elem);
+      r->complete (r);
+    }
+}
+
+/* Queues request R for BLOCK and returns without waiting for
+   it.  BLOCK's worker thread calls R->COMPLETE once the transfer
+   is done.  If BLOCK is layered on another device, R is instead
+   handed to BLOCK's driver whole, which passes it on. */
+void
+block_submit (struct block *block, struct block_request *r)
+{
+  check_sectors (block, r->sector, r->cnt);
+  ASSERT (!r->write || block->type != BLOCK_FOREIGN);
+  ASSERT (r->complete != NULL);
+
+  if (r->cnt == 0)
+    {
+      r->complete (r);
+      return;
+    }
+
+  r->submit_time = timer_usecs ();
+  lock_acquire (&block->queue_lock);
+  if (++block->in_flight > block->max_in_flight)
+    block->max_in_flight = block->in_flight;
+  if (block->ops->submit != NULL)
+    {
+      lock_release (&block->queue_lock);
+      block->ops->submit (block->aux, r);
+      return;
+    }
+  list_insert_ordered (&block->queue, &r->elem, request_less, NULL);
+  cond_signal (&block->queue_nonempty, &block->queue_lock);
+  lock_release (&block->queue_lock);
+}
+
+/* Called by the driver of BLOCK, a device layered on another,
+   once request R, passed to its SUBMIT function, is done.  The
+   driver must have set R->ISSUE_TIME to when the transfer was
+   issued to the device below.  Records R in BLOCK's statistics
+   and calls R->COMPLETE. */
+void
+block_complete (struct block *block, struct block_request *r)
+{
+  int64_t now = timer_usecs ();
+
+  ASSERT (block->ops->submit != NULL);
+
+  lock_acquire (&block->queue_lock);
+  if (r->write)
+    block->write_cnt += r->cnt;
+  else
+    block->read_cnt += r->cnt;
+  account (block, r, now);
+  lock_release (&block->queue_lock);
+  r->complete (r);
+}
+
+/* Worker thread for block device BLOCK_.  Issues the device's
+   queued requests, so that submitters sleep or keep running
+   instead of driving the hardware themselves.  Requests that
+   arrive while a transfer is in progress are merged and ordered
+   by the elevator in next_batch().  Each device has its own
+   worker, so devices on different IDE channels transfer at the
+   same time, while those sharing a channel take turns on its
+   lock. */
+static void
+block_worker (void *block_)
+{
+  struct block *block = block_;
+
+  lock_acquire (&block->queue_lock);
+  for (;;)
+    {
+      struct list batch;
+
+      while (list_empty (&block->queue))
+        cond_wait (&block->queue_nonempty, &block->queue_lock);
+      list_init (&batch);
+      next_batch (block, &batch);
+      lock_release (&block->queue_lock);
+      issue_batch (block, &batch);
+      lock_acquire (&block->queue_lock);
+    }
+}
+
+/* Completion function for synchronous requests.  Wakes up the
+   thread waiting in sync_request(). */
+static void
+wake_requester (struct block_request *r)
+{
+  sema_up (r->aux);
+}
+
+/* Submits a request to transfer the CNT sectors starting at
+   SECTOR between BLOCK and BUFFER and waits for it to finish. */
+static void
+sync_request (struct block *block, block_sector_t sector, block_sector_t cnt,
+              void *buffer, bool write)
+{
+  struct block_request r;
+  struct semaphore done;
+
+  sema_init (&done, 0);
+  r.sector = sector;
+  r.cnt = cnt;
+  r.buffer = buffer;
+  r.write = write;
+  r.complete = wake_requester;
+  r.aux = &done;
+  block_submit (block, &r);
+  sema_down (&done);
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -121,8 +494,7 @@ void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
   check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  sync_request (block, sector, 1, buffer, false);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -135,8 +507,36 @@ block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
   check_sector (block, sector);
   ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+
+  /* The buffer is only read from, since this is a write. */
+  sync_request (block, sector, 1, (void *) buffer, true);
+}
+
+/* Reads the CNT consecutive sectors starting at SECTOR from
+   BLOCK into BUFFER, which must have room for CNT *
+   BLOCK_SECTOR_SIZE bytes.  If the driver supports it, this is
+   a single request to the device rather than one per sector.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector,
+                     block_sector_t cnt, void *buffer)
+{
+  sync_request (block, sector, cnt, buffer, false);
+}
+
+/* Writes the CNT consecutive sectors starting at SECTOR to BLOCK
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving all
+   of the data.  If the driver supports it, this is a single
+   request to the device rather than one per sector.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      block_sector_t cnt, const void *buffer)
+{
+  sync_request (block, sector, cnt, (void *) buffer, true);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,21 +560,92 @@ block_type (struct block *block)
   return block->type;
 }
 
-/* Prints statistics for each block device used for a Pintos role. */
+/* Prints the nonzero buckets of latency histogram HIST, labeled
+   with NAME. */
+static void
+print_hist (const char *name, const unsigned hist[BLOCK_HIST_BUCKETS])
+{
+  int i;
+
+  printf ("  %s:", name);
+  for (i = 0; i < BLOCK_HIST_BUCKETS; i++)
+    if (hist[i] != 0)
+      {
+        if (i < BLOCK_HIST_BUCKETS - 1)
+          printf (" <%lldus %u", 1LL << i, hist[i]);
+        else
+          printf (" more %u", hist[i]);
+      }
+  printf ("\n");
+}
+
+/* Prints statistics for each block device used for a Pintos
+   role or that has seen any requests, followed by the IDE
+   channels' utilisation, and the request traces if tracing is
+   on.  A partition's requests are counted both for it and for
+   the device it is on. */
 void
 block_print_stats (void)
 {
-  int i;
+  struct list_elem *e;
 
-  for (i = 0; i < BLOCK_CNT; i++)
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
     {
-      struct block *block = block_by_role[i];
-      if (block != NULL)
+      struct block *block = list_entry (e, struct block, list_elem);
+      bool has_role = (block->type < BLOCK_ROLE_CNT
+                       && block_by_role[block->type] == block);
+      if (has_role || block->request_cnt > 0)
         {
           printf ("%s (%s): %llu reads, %llu writes\n",
                   block->name, block_type_name (block->type),
                   block->read_cnt, block->write_cnt);
+          printf ("  %llu requests, %llu bytes, %llu merged, "
+                  "at most %d in flight\n",
+                  block->request_cnt,
+                  (block->read_cnt + block->write_cnt) * BLOCK_SECTOR_SIZE,
+                  block->merge_cnt, block->max_in_flight);
+          print_hist ("queue time", block->queue_hist);
+          print_hist ("service time", block->service_hist);
+        }
+    }
+  ide_print_stats ();
+  if (block_trace)
+    block_print_trace ();
+}
+
+/* Prints the requests recorded in each block device's trace,
+   oldest first, with times in microseconds. */
+void
+block_print_trace (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
+    {
+      struct block *block = list_entry (e, struct block, list_elem);
+      unsigned long long i;
+
+      if (block->trace == NULL)
+        continue;
+
+      lock_acquire (&block->queue_lock);
+      printf ("%s: trace of last %llu requests\n", block->name,
+              (block->trace_cnt < BLOCK_TRACE_SIZE
+               ? block->trace_cnt : BLOCK_TRACE_SIZE));
+      i = (block->trace_cnt > BLOCK_TRACE_SIZE
+           ? block->trace_cnt - BLOCK_TRACE_SIZE : 0);
+      for (; i < block->trace_cnt; i++)
+        {
+          struct block_trace_entry *t = &block->trace[i % BLOCK_TRACE_SIZE];
+          printf ("  %c %"PRDSNu"+%"PRDSNu" at %"PRId64": "
+                  "queued %"PRId64", serviced %"PRId64"\n",
+                  t->write ? 'W' : 'R', t->sector, t->cnt, t->submit_time,
+                  t->issue_time - t->submit_time,
+                  t->complete_time - t->issue_time);
         }
+      lock_release (&block->queue_lock);
     }
 }
 
@@ -200,6 +671,24 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  lock_init (&block->queue_lock);
+  list_init (&block->queue);
+  cond_init (&block->queue_nonempty);
+  block->head = 0;
+  block->request_cnt = block->merge_cnt = 0;
+  block->in_flight = block->max_in_flight = 0;
+  memset (block->queue_hist, 0, sizeof block->queue_hist);
+  memset (block->service_hist, 0, sizeof block->service_hist);
+  block->trace = NULL;
+  block->trace_cnt = 0;
+  if (block_trace)
+    {
+      block->trace = calloc (BLOCK_TRACE_SIZE, sizeof *block->trace);
+      if (block->trace == NULL)
+        printf ("%s: no memory for request trace\n", name);
+    }
+  if (ops->submit == NULL)
+    thread_create (block->name, PRI_DEFAULT, block_worker, block);
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
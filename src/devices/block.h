@@ -1,6 +1,8 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <list.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
 
@@ -14,6 +16,9 @@
    Good enough for devices up to 2 TB. */
 typedef uint32_t block_sector_t;
 
+/* Largest number of sectors a block device can have. */
+#define BLOCK_SECTOR_MAX UINT32_MAX
+
 /* Format specifier for printf(), e.g.:
    printf ("sector=%"PRDSNu"\n", sector); */
 #define PRDSNu PRIu32
@@ -53,11 +58,49 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, block_sector_t cnt,
+                          void *);
+void block_write_multiple (struct block *, block_sector_t, block_sector_t cnt,
+                           const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* Asynchronous requests. */
+
+struct block_request;
+typedef void block_request_func (struct block_request *);
+
+/* A request to read or write CNT consecutive sectors of a block
+   device.  Filled in by the caller and passed to block_submit(),
+   which calls COMPLETE once the transfer is done.  The caller
+   must not touch the request or its buffer in the meantime, nor
+   have another request for any of the same sectors outstanding,
+   since requests may be reordered. */
+struct block_request
+  {
+    struct list_elem elem;              /* Element in device queue. */
+    block_sector_t sector;              /* First sector. */
+    block_sector_t cnt;                 /* Number of sectors. */
+    void *buffer;                       /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    bool write;                         /* Write (true) or read (false)? */
+    block_request_func *complete;       /* Called when done. */
+    void *aux;                          /* For COMPLETE's use. */
+
+    /* Set by the block layer. */
+    int64_t submit_time;                /* When submitted, in us. */
+    int64_t issue_time;                 /* When issued to driver, in us. */
+  };
+
+void block_submit (struct block *, struct block_request *);
+
 /* Statistics. */
 void block_print_stats (void);
+void block_print_trace (void);
+
+/* If true, each block device keeps a trace of its most recent
+   requests.  Controlled by kernel command-line option
+   "-blktrace". */
+extern bool block_trace;
 
 /* Lower-level interface to block device drivers. */
 
@@ -65,10 +108,27 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer CNT contiguous sectors at once.  If
+       null, the block layer calls READ or WRITE once per
+       sector instead. */
+    void (*read_multiple) (void *aux, block_sector_t, block_sector_t cnt,
+                           void *buffer);
+    void (*write_multiple) (void *aux, block_sector_t, block_sector_t cnt,
+                            const void *buffer);
+
+    /* Optional.  For a device layered on another, such as a
+       partition: takes request R, whose sectors are relative to
+       this device, and passes it on, instead of the block layer
+       queueing R for a worker thread that calls the functions
+       above, which are then unused.  Must arrange for
+       block_complete() to be called once R is done. */
+    void (*submit) (void *aux, struct block_request *r);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+void block_complete (struct block *, struct block_request *);
 
 #endif /* devices/block.h */
@@ -1,17 +1,24 @@
 #include "devices/ide.h"
 #include <ctype.h>
 #include <debug.h>
+#include <round.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].  If the
+   controller is a PCI bus master, as the PIIX controllers in
+   QEMU and most PCs are, disk data moves by DMA as described in
+   [PIIX]; otherwise it moves through the CPU by PIO. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -30,10 +37,24 @@
 #define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /* Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /* Alt Status (r/o). */
 
+/* Bus master IDE port addresses. */
+#define bm_command(CHANNEL) ((CHANNEL)->bm_base + 0)    /* Command. */
+#define bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)     /* Status. */
+#define bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)       /* PRD table. */
+
+/* Bus master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus master Status Register bits. */
+#define BM_STA_ERR 0x02         /* Error (write 1 to clear). */
+#define BM_STA_INTR 0x04        /* Interrupt (write 1 to clear). */
+
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +70,23 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+#define CMD_READ_SECTORS_EXT 0x24       /* READ SECTOR(S) EXT. */
+#define CMD_READ_DMA_EXT 0x25           /* READ DMA EXT. */
+#define CMD_READ_MULTIPLE_EXT 0x29      /* READ MULTIPLE EXT. */
+#define CMD_WRITE_SECTORS_EXT 0x34      /* WRITE SECTOR(S) EXT. */
+#define CMD_WRITE_DMA_EXT 0x35          /* WRITE DMA EXT. */
+#define CMD_WRITE_MULTIPLE_EXT 0x39     /* WRITE MULTIPLE EXT. */
+
+/* Most sectors a single read or write command can transfer, with
+   28-bit and 48-bit addressing respectively.  The Sector Count
+   register holds 0 to mean this many. */
+#define ATA_MAX_SECTORS 256
+#define ATA_MAX_SECTORS_EXT 65536
 
 /* An ATA device. */
 struct ata_disk
@@ -57,8 +95,29 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per interrupt in READ/WRITE
+                                   MULTIPLE, or 0 if not enabled. */
+    bool dma;                   /* Transfer data by DMA? */
+    bool lba48;                 /* Use 48-bit addressing? */
+  };
+
+/* A physical region descriptor: one entry in the scatter/gather
+   list that a bus master channel follows.  A region may not
+   cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address of region. */
+    uint16_t size;              /* Bytes in region; 0 means 64 kB. */
+    uint16_t flags;             /* PRD_EOT in the last entry. */
   };
 
+#define PRD_EOT 0x8000          /* End of table. */
+
+/* Most sectors one DMA transfer can cover.  A channel's PRD table
+   is one page, and a region within it covers at most 64 kB. */
+#define DMA_MAX_SECTORS ((PGSIZE / sizeof (struct prd) - 1)        \
+                         * (0x10000 / BLOCK_SECTOR_SIZE))
+
 /* An ATA channel (aka controller).
    Each channel can control up to two disks. */
 struct channel
@@ -71,6 +130,18 @@ struct channel
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
+    int irq_wait;               /* Interrupts until the waiter is woken,
+                                   0 if further ones are only
+                                   acknowledged. */
+
+    uint16_t bm_base;           /* Bus master base port, or 0 if none. */
+    struct prd *prdt;           /* PRD table, one page. */
+
+    /* Statistics, protected by LOCK. */
+    unsigned long long request_cnt;     /* Transfers performed. */
+    int64_t busy_usecs;         /* Microseconds spent in transfers. */
+    unsigned long long interrupt_cnt;   /* Interrupts taken. */
+    unsigned long long wakeup_cnt;      /* Waiting thread woken. */
 
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
@@ -81,26 +152,35 @@ static struct channel channels[CHANNEL_CNT];
 
 static struct block_operations ide_operations;
 
+static uint16_t find_bus_master (void);
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
-static void issue_pio_command (struct channel *, uint8_t command);
-static void input_sector (struct channel *, void *);
-static void output_sector (struct channel *, const void *);
+static void set_multiple_mode (struct ata_disk *, int cnt);
+
+static void select_sector (struct ata_disk *, block_sector_t, int cnt);
+static void issue_command (struct channel *, uint8_t command);
+static void input_sectors (struct channel *, void *, int cnt);
+static void output_sectors (struct channel *, const void *, int cnt);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
+static bool wait_for_drq (const struct ata_disk *);
 static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
 static void interrupt_handler (struct intr_frame *);
 
+/* If true, disks of 1 GB or more are used rather than ignored.
+   Controlled by kernel command-line option "-bigdisk". */
+bool ide_allow_big_disks;
+
 /* Initialize the disk subsystem and detect disks. */
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -126,6 +206,22 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      c->irq_wait = 0;
+      c->request_cnt = 0;
+      c->busy_usecs = 0;
+      c->interrupt_cnt = c->wakeup_cnt = 0;
+      if (bm_base != 0)
+        {
+          /* The primary channel's registers come first, then the
+             secondary's. */
+          c->bm_base = bm_base + 8 * chan_no;
+          c->prdt = palloc_get_page (PAL_ASSERT);
+        }
+      else
+        {
+          c->bm_base = 0;
+          c->prdt = NULL;
+        }
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +232,9 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
+          d->dma = false;
+          d->lba48 = false;
         }
 
       /* Register interrupt handler. */
@@ -155,8 +254,50 @@ ide_init (void)
     }
 }
 
+/* Prints each IDE channel's transfer, interrupt, and wakeup
+   counts and the share of the time since boot that it spent
+   transferring. */
+void
+ide_print_stats (void)
+{
+  int64_t usecs = timer_usecs ();
+  struct channel *c;
+
+  for (c = channels; c < channels + CHANNEL_CNT; c++)
+    if (c->devices[0].is_ata || c->devices[1].is_ata)
+      printf ("%s: %llu transfers, %llu interrupts, %llu wakeups, "
+              "busy %"PRId64" of %"PRId64" us (%"PRId64"%%)\n",
+              c->name, c->request_cnt, c->interrupt_cnt, c->wakeup_cnt,
+              c->busy_usecs, usecs,
+              usecs > 0 ? c->busy_usecs * 100 / usecs : 0);
+}
+
 /* Disk detection and identification. */
 
+/* Looks for a PCI IDE controller that can master the bus, and
+   if there is one, enables it for DMA and returns the base of
+   its bus master registers.  Returns 0 if there is none, in
+   which case all transfers use PIO. */
+static uint16_t
+find_bus_master (void)
+{
+  struct pci_device *p;
+
+  for (p = pci_first (); p != NULL; p = pci_next (p))
+    if (p->class == PCI_CLASS_STORAGE && p->subclass == PCI_SUBCLASS_IDE
+        && (p->prog_if & 0x80) != 0)
+      {
+        uint16_t base = pci_io_bar (p, 4);
+        if (base != 0)
+          {
+            pci_enable_bus_master (p);
+            printf ("ide: bus master DMA at port %#"PRIx16"\n", base);
+            return base;
+          }
+      }
+  return 0;
+}
+
 static char *descramble_ata_string (char *, int size);
 
 /* Resets an ATA channel and waits for any devices present on it
@@ -261,7 +402,7 @@ identify_ata_device (struct ata_disk *d)
 {
   struct channel *c = d->channel;
   char id[BLOCK_SECTOR_SIZE];
-  block_sector_t capacity;
+  uint64_t capacity;
   char *model, *serial;
   char extra_info[128];
   struct block *block;
@@ -272,18 +413,24 @@ identify_ata_device (struct ata_disk *d)
      indicating the device's response is ready, and read the data
      into our buffer. */
   select_device_wait (d);
-  issue_pio_command (c, CMD_IDENTIFY_DEVICE);
+  issue_command (c, CMD_IDENTIFY_DEVICE);
   sema_down (&c->completion_wait);
   if (!wait_while_busy (d))
     {
       d->is_ata = false;
       return;
     }
-  input_sector (c, id);
+  input_sectors (c, id, 1);
 
-  /* Calculate capacity.
+  /* Calculate capacity, from the 48-bit count in words 100-103
+     if bit 10 of word 83 says the disk supports LBA48 and from
+     the 28-bit count in words 60-61 otherwise.
      Read model name and serial number. */
-  capacity = *(uint32_t *) &id[60 * 2];
+  d->lba48 = (id[83 * 2 + 1] & 0x04) != 0;
+  if (d->lba48)
+    capacity = *(uint64_t *) &id[100 * 2];
+  else
+    capacity = *(uint32_t *) &id[60 * 2];
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
   snprintf (extra_info, sizeof extra_info,
@@ -292,9 +439,10 @@ identify_ata_device (struct ata_disk *d)
   /* Disable access to IDE disks over 1 GB, which are likely
      physical IDE disks rather than virtual ones.  If we don't
      allow access to those, we're less likely to scribble on
-     someone's important data.  You can disable this check by
-     hand if you really want to do so. */
-  if (capacity >= 1024 * 1024 * 1024 / BLOCK_SECTOR_SIZE)
+     someone's important data.  The "-bigdisk" kernel option
+     disables this check, for large disk images. */
+  if (!ide_allow_big_disks
+      && capacity >= 1024 * 1024 * 1024 / BLOCK_SECTOR_SIZE)
     {
       printf ("%s: ignoring ", d->name);
       print_human_readable_size (capacity * 512);
@@ -303,6 +451,24 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Sector numbers are only 32 bits wide. */
+  if (capacity > BLOCK_SECTOR_MAX)
+    {
+      printf ("%s: using only the first ", d->name);
+      print_human_readable_size ((uint64_t) BLOCK_SECTOR_MAX * 512);
+      printf ("\n");
+      capacity = BLOCK_SECTOR_MAX;
+    }
+
+  /* Word 47 gives the most sectors the disk can move per
+     interrupt with READ/WRITE MULTIPLE, or 0 if it does not
+     support them. */
+  if ((uint8_t) id[47 * 2] > 0)
+    set_multiple_mode (d, (uint8_t) id[47 * 2]);
+
+  /* Bit 8 of word 49 says whether the disk does DMA. */
+  d->dma = c->bm_base != 0 && (id[49 * 2 + 1] & 0x01) != 0;
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
@@ -337,97 +503,337 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Sends SET MULTIPLE MODE to disk D to make it transfer CNT
+   sectors per interrupt in READ/WRITE MULTIPLE commands.  If the
+   disk accepts, D uses those commands from now on. */
+static void
+set_multiple_mode (struct ata_disk *d, int cnt)
+{
+  struct channel *c = d->channel;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), cnt);
+  issue_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_alt_status (c)) & STA_ERR) == 0)
+    d->multiple = cnt;
+}
+
+/* Returns the number of sectors disk D moves per interrupt. */
+static int
+sectors_per_interrupt (const struct ata_disk *d)
+{
+  return d->multiple > 0 ? d->multiple : 1;
+}
+
+/* Returns the most sectors that one command to disk D can
+   transfer, by DMA if DMA is true. */
+static block_sector_t
+max_sectors (const struct ata_disk *d, bool dma)
+{
+  block_sector_t max = d->lba48 ? ATA_MAX_SECTORS_EXT : ATA_MAX_SECTORS;
+  if (dma && max > DMA_MAX_SECTORS)
+    max = DMA_MAX_SECTORS;
+  return max;
+}
+
+/* Returns true if a transfer between disk D and BUFFER can use
+   DMA.  The bus master needs a kernel address, which is mapped
+   to physically contiguous memory, and an even one. */
+static bool
+can_dma (const struct ata_disk *d, const void *buffer)
+{
+  return d->dma && is_kernel_vaddr (buffer) && ((uintptr_t) buffer & 1) == 0;
+}
+
+/* Fills in channel C's PRD table to describe the SIZE bytes at
+   BUFFER, splitting the buffer at 64 kB boundaries. */
+static void
+build_prdt (struct channel *c, const void *buffer, size_t size)
+{
+  uintptr_t addr = vtop (buffer);
+  struct prd *prd = c->prdt;
+
+  ASSERT (size > 0);
+  while (size > 0)
+    {
+      size_t chunk = 0x10000 - (addr & 0xffff);
+      if (chunk > size)
+        chunk = size;
+      prd->addr = addr;
+      prd->size = chunk & 0xffff;
+      prd->flags = 0;
+      addr += chunk;
+      size -= chunk;
+      prd++;
+    }
+  prd[-1].flags = PRD_EOT;
+}
+
+/* Transfers the CNT sectors starting at SEC_NO between disk D and
+   BUFFER by bus master DMA, reading into BUFFER if WRITE is
+   false and writing from it otherwise.  The CPU is free to run
+   other threads until the completion interrupt.  D's channel
+   lock must be held. */
+static void
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, int cnt,
+              const void *buffer, bool write)
+{
+  struct channel *c = d->channel;
+  uint8_t direction = write ? 0 : BM_CMD_READ;
+  uint8_t bm_sta;
+
+  build_prdt (c, buffer, cnt * BLOCK_SECTOR_SIZE);
+  outl (bm_prdt (c), vtop (c->prdt));
+  outb (bm_command (c), direction);
+  outb (bm_status (c), BM_STA_ERR | BM_STA_INTR);
+
+  select_sector (d, sec_no, cnt);
+  if (d->lba48)
+    issue_command (c, write ? CMD_WRITE_DMA_EXT : CMD_READ_DMA_EXT);
+  else
+    issue_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (bm_command (c), direction | BM_CMD_START);
+  sema_down (&c->completion_wait);
+
+  outb (bm_command (c), direction);
+  bm_sta = inb (bm_status (c));
+  outb (bm_status (c), BM_STA_ERR | BM_STA_INTR);
+  if ((bm_sta & BM_STA_ERR) != 0 || (inb (reg_alt_status (c)) & STA_ERR) != 0)
+    PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+           d->name, write ? "write" : "read", sec_no);
+}
+
+/* Transfers the CNT sectors starting at SEC_NO between disk D
+   and BUFFER in PIO mode, reading into BUFFER if WRITE is false
+   and writing from it otherwise.  The data moves a DRQ block of
+   D->multiple sectors at a time in this thread, which sleeps
+   once per command: a read until its first block is ready, a
+   write until the disk has taken its last one.  In between it
+   polls for each block, and the interrupt handler only
+   acknowledges the disk's other interrupts.  D's channel lock
+   must be held. */
+static void
+pio_transfer (struct ata_disk *d, block_sector_t sec_no, int cnt,
+              const void *buffer, bool write)
+{
+  struct channel *c = d->channel;
+  int chunk = sectors_per_interrupt (d);
+  uint8_t *p = (uint8_t *) buffer;
+  int left;
+
+  select_sector (d, sec_no, cnt);
+  if (d->lba48)
+    issue_command (c, (write
+                       ? (d->multiple > 0
+                          ? CMD_WRITE_MULTIPLE_EXT : CMD_WRITE_SECTORS_EXT)
+                       : (d->multiple > 0
+                          ? CMD_READ_MULTIPLE_EXT : CMD_READ_SECTORS_EXT)));
+  else
+    issue_command (c, (write
+                       ? (d->multiple > 0
+                          ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR_RETRY)
+                       : (d->multiple > 0
+                          ? CMD_READ_MULTIPLE : CMD_READ_SECTOR_RETRY)));
+
+  /* A write interrupts after each block it takes, but not before
+     the first, so there is no race in counting them here. */
+  if (write)
+    c->irq_wait = DIV_ROUND_UP (cnt, chunk);
+  else
+    sema_down (&c->completion_wait);
+
+  for (left = cnt; left > 0; )
+    {
+      int n = left < chunk ? left : chunk;
+
+      if (!wait_for_drq (d))
+        PANIC ("%s: disk %s failed, sector=%"PRDSNu, d->name,
+               write ? "write" : "read", sec_no + (cnt - left));
+      if (write)
+        output_sectors (c, p, n);
+      else
+        input_sectors (c, p, n);
+      p += n * BLOCK_SECTOR_SIZE;
+      left -= n;
+    }
+
+  if (write)
+    sema_down (&c->completion_wait);
+  if ((inb (reg_alt_status (c)) & STA_ERR) != 0)
+    PANIC ("%s: disk %s failed, sector=%"PRDSNu, d->name,
+           write ? "write" : "read", sec_no);
+}
+
+/* Reads the CNT sectors starting at SEC_NO from disk D into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Issues as few commands as the disk's addressing mode
+   allows, by DMA if possible.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read_multiple (void *d_, block_sector_t sec_no, block_sector_t cnt,
+                   void *buffer_)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+  int64_t start;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  start = timer_usecs ();
+  while (cnt > 0)
+    {
+      bool dma = can_dma (d, buffer);
+      int n = cnt < max_sectors (d, dma) ? cnt : max_sectors (d, dma);
+
+      if (dma)
+        dma_transfer (d, sec_no, n, buffer, false);
+      else
+        pio_transfer (d, sec_no, n, buffer, false);
+      buffer += n * BLOCK_SECTOR_SIZE;
+      sec_no += n;
+      cnt -= n;
+    }
+  c->request_cnt++;
+  c->busy_usecs += timer_usecs () - start;
   lock_release (&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+/* Writes the CNT sectors starting at SEC_NO to disk D from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the disk has acknowledged receiving the data.
+   Issues commands as ide_read_multiple() does.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_write_multiple (void *d_, block_sector_t sec_no, block_sector_t cnt,
+                    const void *buffer_)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  const uint8_t *buffer = buffer_;
+  int64_t start;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  start = timer_usecs ();
+  while (cnt > 0)
+    {
+      bool dma = can_dma (d, buffer);
+      int n = cnt < max_sectors (d, dma) ? cnt : max_sectors (d, dma);
+
+      if (dma)
+        dma_transfer (d, sec_no, n, buffer, true);
+      else
+        pio_transfer (d, sec_no, n, buffer, true);
+      buffer += n * BLOCK_SECTOR_SIZE;
+      sec_no += n;
+      cnt -= n;
+    }
+  c->request_cnt++;
+  c->busy_usecs += timer_usecs () - start;
   lock_release (&c->lock);
 }
 
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read (void *d_, block_sector_t sec_no, void *buffer)
+{
+  ide_read_multiple (d_, sec_no, 1, buffer);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multiple (d_, sec_no, 1, buffer);
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple,
+    NULL
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the sector count CNT to the disk's sector
+   selection registers.  (We use LBA mode.)  With 48-bit
+   addressing, each register takes two writes, high-order byte
+   first; a count of ATA_MAX_SECTORS_EXT becomes 0 either way. */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, int cnt)
 {
   struct channel *c = d->channel;
+  uint8_t dev = DEV_MBS | DEV_LBA | (d->dev_no == 1 ? DEV_DEV : 0);
 
-  ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && (block_sector_t) cnt <= max_sectors (d, false));
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
-  outb (reg_lbal (c), sec_no);
-  outb (reg_lbam (c), sec_no >> 8);
-  outb (reg_lbah (c), (sec_no >> 16));
-  outb (reg_device (c),
-        DEV_MBS | DEV_LBA | (d->dev_no == 1 ? DEV_DEV : 0) | (sec_no >> 24));
+  if (d->lba48)
+    {
+      outb (reg_nsect (c), cnt >> 8);
+      outb (reg_lbal (c), sec_no >> 24);
+      outb (reg_lbam (c), 0);
+      outb (reg_lbah (c), 0);
+      outb (reg_nsect (c), cnt);
+      outb (reg_lbal (c), sec_no);
+      outb (reg_lbam (c), sec_no >> 8);
+      outb (reg_lbah (c), sec_no >> 16);
+      outb (reg_device (c), dev);
+    }
+  else
+    {
+      ASSERT (sec_no < (1UL << 28));
+      outb (reg_nsect (c), cnt == ATA_MAX_SECTORS ? 0 : cnt);
+      outb (reg_lbal (c), sec_no);
+      outb (reg_lbam (c), sec_no >> 8);
+      outb (reg_lbah (c), (sec_no >> 16));
+      outb (reg_device (c), dev | (sec_no >> 24));
+    }
 }
 
 /* Writes COMMAND to channel C and prepares for receiving a
    completion interrupt. */
 static void
-issue_pio_command (struct channel *c, uint8_t command) 
+issue_command (struct channel *c, uint8_t command) 
 {
   /* Interrupts must be enabled or our semaphore will never be
      up'd by the completion handler. */
   ASSERT (intr_get_level () == INTR_ON);
 
   c->expecting_interrupt = true;
+  c->irq_wait = 1;
+  barrier ();
   outb (reg_command (c), command);
 }
 
-/* Reads a sector from channel C's data register in PIO mode into
-   SECTOR, which must have room for BLOCK_SECTOR_SIZE bytes. */
+/* Reads CNT sectors from channel C's data register in PIO mode
+   into SECTORS, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
 static void
-input_sector (struct channel *c, void *sector) 
+input_sectors (struct channel *c, void *sectors, int cnt) 
 {
-  insw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  insw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
-/* Writes SECTOR to channel C's data register in PIO mode.
-   SECTOR must contain BLOCK_SECTOR_SIZE bytes. */
+/* Writes CNT sectors from SECTORS to channel C's data register in
+   PIO mode.  SECTORS must contain CNT * BLOCK_SECTOR_SIZE
+   bytes. */
 static void
-output_sector (struct channel *c, const void *sector) 
+output_sectors (struct channel *c, const void *sectors, int cnt) 
 {
-  outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  outsw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
 /* Low-level ATA primitives. */
@@ -479,6 +885,31 @@ wait_while_busy (const struct ata_disk *d)
   return false;
 }
 
+/* Waits for disk D to be ready to move its next DRQ block,
+   polling the alternate status register so that pending
+   interrupts are left alone.  Spins briefly before falling back
+   to wait_while_busy(), since the next block of a command is
+   usually not far behind.  Returns true if the disk is ready,
+   false if it reported an error or timed out. */
+static bool
+wait_for_drq (const struct ata_disk *d)
+{
+  struct channel *c = d->channel;
+  uint8_t status;
+  int i;
+
+  for (i = 0; i < 1000; i++)
+    {
+      status = inb (reg_alt_status (c));
+      if (!(status & STA_BSY))
+        return (status & (STA_ERR | STA_DRQ)) == STA_DRQ;
+      timer_usleep (10);
+    }
+
+  return (wait_while_busy (d)
+          && (inb (reg_alt_status (c)) & STA_ERR) == 0);
+}
+
 /* Program D's channel so that D is now the selected disk. */
 static void
 select_device (const struct ata_disk *d)
@@ -513,8 +944,16 @@ interrupt_handler (struct intr_frame *f)
       {
         if (c->expecting_interrupt) 
           {
-            inb (reg_status (c));               /* Acknowledge interrupt. */
-            sema_up (&c->completion_wait);      /* Wake up waiter. */
+            inb (reg_status (c));               /* Acknowledge. */
+            c->interrupt_cnt++;
+
+            /* A PIO command interrupts for every block, but its
+               waiter only needs waking once. */
+            if (c->irq_wait > 0 && --c->irq_wait == 0)
+              {
+                c->wakeup_cnt++;
+                sema_up (&c->completion_wait);  /* Wake up waiter. */
+              }
           }
         else
           printf ("%s: unexpected interrupt\n", c->name);
@@ -1,6 +1,13 @@
 #ifndef DEVICES_IDE_H
 #define DEVICES_IDE_H
 
+#include <stdbool.h>
+
+/* If true, disks of 1 GB or more are used rather than ignored.
+   Controlled by kernel command-line option "-bigdisk". */
+extern bool ide_allow_big_disks;
+
 void ide_init (void);
+void ide_print_stats (void);
 
 #endif /* devices/ide.h */
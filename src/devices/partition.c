@@ -4,6 +4,7 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/block.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
 
 /* A partition of a block device. */
@@ -11,6 +12,7 @@ struct partition
   {
     struct block *block;                /* Underlying block device. */
     block_sector_t start;               /* First sector within device. */
+    struct block *self;                 /* The partition's block device. */
   };
 
 static struct block_operations partition_operations;
@@ -181,7 +183,8 @@ found_partition (struct block *block, uint8_t part_type,
       snprintf (name, sizeof name, "%s%d", block_name (block), part_nr);
       snprintf (extra_info, sizeof extra_info, "%s (%02x)",
                 partition_type_name (part_type), part_type);
-      block_register (name, type, extra_info, size, &partition_operations, p);
+      p->self = block_register (name, type, extra_info, size,
+                                &partition_operations, p);
     }
 }
 
@@ -298,27 +301,66 @@ partition_type_name (uint8_t type)
   return type_names[type] != NULL ? type_names[type] : "Unknown";
 }
 
-/* Reads sector SECTOR from partition P into BUFFER, which must
-   have room for BLOCK_SECTOR_SIZE bytes. */
+/* A request to the underlying device made on behalf of a
+   request to a partition. */
+struct partition_request
+  {
+    struct block_request r;             /* Request to underlying device. */
+    struct block_request *orig;         /* Request to partition. */
+    struct partition *p;                /* The partition. */
+  };
+
+static block_request_func partition_complete;
+
+/* Passes request ORIG, for partition P, to the underlying device
+   whole, offset by the partition's start, so that it is queued,
+   merged, and transferred there like any other request. */
 static void
-partition_read (void *p_, block_sector_t sector, void *buffer)
+partition_submit (void *p_, struct block_request *orig)
 {
   struct partition *p = p_;
-  block_read (p->block, p->start + sector, buffer);
+  struct partition_request *pr = malloc (sizeof *pr);
+
+  if (pr == NULL)
+    {
+      /* Out of memory: transfer synchronously instead. */
+      orig->issue_time = timer_usecs ();
+      if (orig->write)
+        block_write_multiple (p->block, p->start + orig->sector, orig->cnt,
+                              orig->buffer);
+      else
+        block_read_multiple (p->block, p->start + orig->sector, orig->cnt,
+                             orig->buffer);
+      block_complete (p->self, orig);
+      return;
+    }
+
+  pr->r.sector = p->start + orig->sector;
+  pr->r.cnt = orig->cnt;
+  pr->r.buffer = orig->buffer;
+  pr->r.write = orig->write;
+  pr->r.complete = partition_complete;
+  pr->r.aux = pr;
+  pr->orig = orig;
+  pr->p = p;
+  block_submit (p->block, &pr->r);
 }
 
-/* Write sector SECTOR to partition P from BUFFER, which must
-   contain BLOCK_SECTOR_SIZE bytes.  Returns after the block has
-   acknowledged receiving the data. */
+/* Completion function for requests made by partition_submit().
+   Completes the partition request on whose behalf R was made. */
 static void
-partition_write (void *p_, block_sector_t sector, const void *buffer)
+partition_complete (struct block_request *r)
 {
-  struct partition *p = p_;
-  block_write (p->block, p->start + sector, buffer);
+  struct partition_request *pr = r->aux;
+  struct block_request *orig = pr->orig;
+  struct block *self = pr->p->self;
+
+  orig->issue_time = r->issue_time;
+  free (pr);
+  block_complete (self, orig);
 }
 
 static struct block_operations partition_operations =
   {
-    partition_read,
-    partition_write
+    .submit = partition_submit
   };
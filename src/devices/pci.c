@@ -0,0 +1,156 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include <stdio.h>
+#include "threads/io.h"
+
+/* The code in this file enumerates the PCI bus through
+   configuration mechanism #1, the one that every PC chipset
+   since the early PCI days (and QEMU) supports.  See [PCI]. */
+
+/* Configuration mechanism #1 ports. */
+#define PCI_CONFIG_ADDR 0xcf8           /* Address to access. */
+#define PCI_CONFIG_DATA 0xcfc           /* Data at that address. */
+
+/* Limits of the bus topology. */
+#define PCI_BUS_CNT 256                 /* Buses. */
+#define PCI_DEV_CNT 32                  /* Devices per bus. */
+#define PCI_FUNC_CNT 8                  /* Functions per device. */
+
+/* Header type bit marking a multi-function device. */
+#define PCI_HEADER_MULTI 0x80
+
+/* Devices found by pci_init().  PCs have few, so a fixed table
+   is plenty. */
+#define PCI_MAX_DEVICES 32
+static struct pci_device devices[PCI_MAX_DEVICES];
+static size_t device_cnt;
+
+static void select_config (int bus, int dev, int func, uint8_t reg);
+static uint32_t read_config (int bus, int dev, int func, uint8_t reg);
+static void probe_function (int bus, int dev, int func);
+
+/* Scans the PCI bus and records every function found. */
+void
+pci_init (void)
+{
+  int bus, dev, func;
+
+  for (bus = 0; bus < PCI_BUS_CNT; bus++)
+    for (dev = 0; dev < PCI_DEV_CNT; dev++)
+      {
+        uint32_t header;
+
+        if ((read_config (bus, dev, 0, PCI_REG_ID) & 0xffff) == 0xffff)
+          continue;
+        probe_function (bus, dev, 0);
+
+        header = read_config (bus, dev, 0, PCI_REG_HEADER) >> 16;
+        if (header & PCI_HEADER_MULTI)
+          for (func = 1; func < PCI_FUNC_CNT; func++)
+            if ((read_config (bus, dev, func, PCI_REG_ID) & 0xffff) != 0xffff)
+              probe_function (bus, dev, func);
+      }
+  printf ("pci: %zu devices\n", device_cnt);
+}
+
+/* Records function FUNC of device DEV on BUS in devices[]. */
+static void
+probe_function (int bus, int dev, int func)
+{
+  struct pci_device *p;
+  uint32_t id, class;
+
+  if (device_cnt >= PCI_MAX_DEVICES)
+    {
+      printf ("pci: too many devices, ignoring %02x:%02x.%d\n",
+              bus, dev, func);
+      return;
+    }
+
+  p = &devices[device_cnt++];
+  id = read_config (bus, dev, func, PCI_REG_ID);
+  class = read_config (bus, dev, func, PCI_REG_CLASS);
+  p->bus = bus;
+  p->dev = dev;
+  p->func = func;
+  p->vendor_id = id & 0xffff;
+  p->device_id = id >> 16;
+  p->class = class >> 24;
+  p->subclass = class >> 16;
+  p->prog_if = class >> 8;
+  p->irq = read_config (bus, dev, func, PCI_REG_IRQ) & 0xff;
+}
+
+/* Returns the first PCI function found, or a null pointer if
+   there are none. */
+struct pci_device *
+pci_first (void)
+{
+  return device_cnt > 0 ? &devices[0] : NULL;
+}
+
+/* Returns the PCI function following P, or a null pointer if P
+   is the last one. */
+struct pci_device *
+pci_next (struct pci_device *p)
+{
+  ASSERT (p >= devices && p < devices + device_cnt);
+  return p + 1 < devices + device_cnt ? p + 1 : NULL;
+}
+
+/* Returns the 32-bit configuration register REG of P.  REG must
+   be a multiple of 4. */
+uint32_t
+pci_read_config (const struct pci_device *p, uint8_t reg)
+{
+  return read_config (p->bus, p->dev, p->func, reg);
+}
+
+/* Sets the 32-bit configuration register REG of P to VALUE.  REG
+   must be a multiple of 4. */
+void
+pci_write_config (const struct pci_device *p, uint8_t reg, uint32_t value)
+{
+  select_config (p->bus, p->dev, p->func, reg);
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Returns the I/O port base in base address register BAR of P,
+   or 0 if BAR does not decode I/O space. */
+uint16_t
+pci_io_bar (const struct pci_device *p, int bar)
+{
+  uint32_t value;
+
+  ASSERT (bar >= 0 && bar < 6);
+  value = pci_read_config (p, PCI_REG_BAR0 + 4 * bar);
+  return (value & 1) ? value & 0xfffc : 0;
+}
+
+/* Lets P decode I/O space and master the bus, for DMA. */
+void
+pci_enable_bus_master (const struct pci_device *p)
+{
+  uint32_t command = pci_read_config (p, PCI_REG_COMMAND);
+  pci_write_config (p, PCI_REG_COMMAND,
+                    command | PCI_CMD_IO | PCI_CMD_BUS_MASTER);
+}
+
+/* Points PCI_CONFIG_DATA at configuration register REG of
+   function FUNC of device DEV on BUS. */
+static void
+select_config (int bus, int dev, int func, uint8_t reg)
+{
+  ASSERT (reg % 4 == 0);
+  outl (PCI_CONFIG_ADDR, (0x80000000 | (bus << 16) | (dev << 11)
+                          | (func << 8) | reg));
+}
+
+/* Reads configuration register REG of function FUNC of device
+   DEV on BUS. */
+static uint32_t
+read_config (int bus, int dev, int func, uint8_t reg)
+{
+  select_config (bus, dev, func, reg);
+  return inl (PCI_CONFIG_DATA);
+}
@@ -0,0 +1,50 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Class codes that Pintos drivers look for. */
+#define PCI_CLASS_STORAGE 0x01          /* Mass storage controller. */
+#define PCI_SUBCLASS_IDE 0x01           /* IDE controller. */
+
+/* Configuration space registers. */
+#define PCI_REG_ID 0x00                 /* Device ID 31:16, vendor ID 15:0. */
+#define PCI_REG_COMMAND 0x04            /* Status 31:16, command 15:0. */
+#define PCI_REG_CLASS 0x08              /* Class, subclass, prog IF, rev. */
+#define PCI_REG_HEADER 0x0c             /* Header type 23:16. */
+#define PCI_REG_BAR0 0x10               /* First base address register. */
+#define PCI_REG_IRQ 0x3c                /* Interrupt line 7:0. */
+
+/* Command register bits. */
+#define PCI_CMD_IO 0x0001               /* Respond to I/O space accesses. */
+#define PCI_CMD_MEMORY 0x0002           /* Respond to memory accesses. */
+#define PCI_CMD_BUS_MASTER 0x0004       /* May act as bus master. */
+
+/* A PCI function found by pci_init(). */
+struct pci_device
+  {
+    uint8_t bus;                /* Bus number. */
+    uint8_t dev;                /* Device number on bus, 0...31. */
+    uint8_t func;               /* Function number in device, 0...7. */
+    uint16_t vendor_id;         /* Vendor ID. */
+    uint16_t device_id;         /* Device ID. */
+    uint8_t class;              /* Base class code. */
+    uint8_t subclass;           /* Subclass code. */
+    uint8_t prog_if;            /* Programming interface. */
+    uint8_t irq;                /* Legacy interrupt line, 0...15. */
+  };
+
+void pci_init (void);
+
+/* Finding devices. */
+struct pci_device *pci_first (void);
+struct pci_device *pci_next (struct pci_device *);
+
+/* Configuration space access. */
+uint32_t pci_read_config (const struct pci_device *, uint8_t reg);
+void pci_write_config (const struct pci_device *, uint8_t reg, uint32_t);
+uint16_t pci_io_bar (const struct pci_device *, int bar);
+void pci_enable_bus_master (const struct pci_device *);
+
+#endif /* devices/pci.h */
@@ -14,6 +14,10 @@
 /* PIT cycles per second. */
 #define PIT_HZ 1193180
 
+/* Counter value each channel was last configured with, in PIT
+   cycles per period. */
+static unsigned periods[3];
+
 /* Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
 
@@ -76,8 +80,33 @@ pit_configure_channel (int channel, int mode, int frequency)
 
   /* Configure the PIT mode and load its counters. */
   old_level = intr_disable ();
+  periods[channel] = count != 0 ? count : 65536;
   outb (PIT_PORT_CONTROL, (channel << 6) | 0x30 | (mode << 1));
   outb (PIT_PORT_COUNTER (channel), count);
   outb (PIT_PORT_COUNTER (channel), count >> 8);
   intr_set_level (old_level);
 }
+
+/* Returns the number of microseconds that CHANNEL, which must be
+   configured in mode 2, has counted since the start of its
+   current period. */
+unsigned
+pit_elapsed_usecs (int channel)
+{
+  enum intr_level old_level;
+  unsigned count;
+
+  ASSERT (channel == 0 || channel == 2);
+  ASSERT (periods[channel] != 0);
+
+  /* Latch the counter, then read it, low byte first. */
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, channel << 6);
+  count = inb (PIT_PORT_COUNTER (channel));
+  count |= inb (PIT_PORT_COUNTER (channel)) << 8;
+  intr_set_level (old_level);
+
+  if (count == 0 || count > periods[channel])
+    count = periods[channel];
+  return (uint64_t) (periods[channel] - count) * 1000000 / PIT_HZ;
+}
@@ -4,5 +4,6 @@
 #include <stdint.h>
 
 void pit_configure_channel (int channel, int mode, int frequency);
+unsigned pit_elapsed_usecs (int channel);
 
 #endif /* devices/pit.h */
@@ -0,0 +1,118 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A RAM disk is a block device whose sectors are kept in memory.
+   It never seeks, so it gives a baseline for measuring file
+   system overhead apart from disk cost, and it makes a fast swap
+   device.  Its contents do not survive a reboot.
+
+   Its pages come from the user pool, like other bulk data, so
+   that even a large RAM disk leaves the kernel pool, which page
+   tables, thread stacks and malloc() depend on, alone. */
+
+/* Number of sectors per page. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* The RAM disk.  The pages need not be contiguous, so that a
+   large RAM disk does not depend on finding a long run of free
+   pages. */
+struct ramdisk
+  {
+    uint8_t **pages;            /* Pages holding the sectors. */
+    size_t page_cnt;            /* Number of pages. */
+  };
+
+static struct ramdisk ramdisk;
+
+static struct block_operations ramdisk_operations;
+
+/* Creates a zero-filled RAM disk of KB kilobytes, rounded down to
+   whole sectors, and registers it as block device "rd0".  Does
+   nothing if KB is 0. */
+void
+ramdisk_init (size_t kb)
+{
+  block_sector_t size = kb * 1024 / BLOCK_SECTOR_SIZE;
+  size_t i;
+
+  if (size == 0)
+    return;
+
+  ramdisk.page_cnt = DIV_ROUND_UP (size, SECTORS_PER_PAGE);
+  ramdisk.pages = malloc (ramdisk.page_cnt * sizeof *ramdisk.pages);
+  if (ramdisk.pages == NULL)
+    PANIC ("Failed to allocate memory for RAM disk page table");
+  for (i = 0; i < ramdisk.page_cnt; i++)
+    {
+      ramdisk.pages[i] = palloc_get_page (PAL_USER | PAL_ZERO);
+      if (ramdisk.pages[i] == NULL)
+        PANIC ("Out of memory for %zu kB RAM disk", kb);
+    }
+
+  block_register ("rd0", BLOCK_RAW, "RAM disk", size,
+                  &ramdisk_operations, &ramdisk);
+}
+
+/* Returns the address of SECTOR in RD. */
+static uint8_t *
+sector_address (struct ramdisk *rd, block_sector_t sector)
+{
+  return (rd->pages[sector / SECTORS_PER_PAGE]
+          + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+/* Reads the CNT sectors starting at SECTOR from RAM disk RD_ into
+   BUFFER. */
+static void
+ramdisk_read_multiple (void *rd_, block_sector_t sector, block_sector_t cnt,
+                       void *buffer_)
+{
+  struct ramdisk *rd = rd_;
+  uint8_t *buffer = buffer_;
+
+  for (; cnt > 0; cnt--, sector++, buffer += BLOCK_SECTOR_SIZE)
+    memcpy (buffer, sector_address (rd, sector), BLOCK_SECTOR_SIZE);
+}
+
+/* Writes the CNT sectors starting at SECTOR to RAM disk RD_ from
+   BUFFER. */
+static void
+ramdisk_write_multiple (void *rd_, block_sector_t sector,
+                        block_sector_t cnt, const void *buffer_)
+{
+  struct ramdisk *rd = rd_;
+  const uint8_t *buffer = buffer_;
+
+  for (; cnt > 0; cnt--, sector++, buffer += BLOCK_SECTOR_SIZE)
+    memcpy (sector_address (rd, sector), buffer, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads sector SECTOR from RAM disk RD into BUFFER. */
+static void
+ramdisk_read (void *rd, block_sector_t sector, void *buffer)
+{
+  ramdisk_read_multiple (rd, sector, 1, buffer);
+}
+
+/* Writes sector SECTOR to RAM disk RD from BUFFER. */
+static void
+ramdisk_write (void *rd, block_sector_t sector, const void *buffer)
+{
+  ramdisk_write_multiple (rd, sector, 1, buffer);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    ramdisk_read_multiple,
+    ramdisk_write_multiple,
+    NULL
+  };
@@ -84,6 +84,21 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
+/* Returns the number of microseconds since the OS booted.  This
+   is finer grained than timer_ticks(), because it also reads how
+   far the PIT has counted toward the next tick.  If a tick is due
+   but has not been taken yet, the result may briefly run up to
+   one tick behind. */
+int64_t
+timer_usecs (void)
+{
+  enum intr_level old_level = intr_disable ();
+  int64_t t = ticks;
+  unsigned usecs = pit_elapsed_usecs (0);
+  intr_set_level (old_level);
+  return t * (1000000 / TIMER_FREQ) + usecs;
+}
+
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
    be turned on. */
 void
@@ -0,0 +1,353 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* The code in this file drives virtio block devices, such as
+   QEMU's "-drive if=virtio", through the legacy virtio PCI
+   interface with a single split virtqueue.  See [VIRTIO]. */
+
+/* PCI IDs of a legacy (transitional) virtio block device. */
+#define VIRTIO_VENDOR_ID 0x1af4
+#define VIRTIO_BLK_DEVICE_ID 0x1001
+
+/* Legacy virtio registers, in I/O space at BAR 0. */
+#define reg_device_features(D) ((D)->io_base + 0x00)    /* 32 bits. */
+#define reg_guest_features(D) ((D)->io_base + 0x04)     /* 32 bits. */
+#define reg_queue_pfn(D) ((D)->io_base + 0x08)          /* 32 bits. */
+#define reg_queue_size(D) ((D)->io_base + 0x0c)         /* 16 bits. */
+#define reg_queue_select(D) ((D)->io_base + 0x0e)       /* 16 bits. */
+#define reg_queue_notify(D) ((D)->io_base + 0x10)       /* 16 bits. */
+#define reg_status(D) ((D)->io_base + 0x12)             /* 8 bits. */
+#define reg_isr(D) ((D)->io_base + 0x13)                /* 8 bits. */
+#define reg_capacity(D) ((D)->io_base + 0x14)           /* 64 bits. */
+
+/* Device Status bits. */
+#define STATUS_ACKNOWLEDGE 0x01 /* Guest has noticed the device. */
+#define STATUS_DRIVER 0x02      /* Guest knows how to drive it. */
+#define STATUS_DRIVER_OK 0x04   /* Driver is ready. */
+#define STATUS_FAILED 0x80      /* Guest gave up on the device. */
+
+/* Virtqueue descriptor flags. */
+#define DESC_NEXT 0x01          /* Chain continues in NEXT. */
+#define DESC_WRITE 0x02         /* Device writes (vs. reads) buffer. */
+
+/* Request types. */
+#define VIRTIO_BLK_T_IN 0       /* Read. */
+#define VIRTIO_BLK_T_OUT 1      /* Write. */
+
+/* Request status written by the device. */
+#define VIRTIO_BLK_S_OK 0
+
+/* Most sectors we put in one request. */
+#define VIRTIO_BLK_MAX_SECTORS 1024
+
+/* Alignment of the used ring within a legacy virtqueue. */
+#define VRING_ALIGN 4096
+
+/* Virtqueue descriptor. */
+struct vring_desc
+  {
+    uint64_t addr;              /* Physical address of buffer. */
+    uint32_t len;               /* Length of buffer. */
+    uint16_t flags;             /* DESC_* flags. */
+    uint16_t next;              /* Next descriptor, if DESC_NEXT. */
+  };
+
+/* Ring of descriptor chains made available to the device. */
+struct vring_avail
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where the driver puts the next entry. */
+    uint16_t ring[];            /* Heads of descriptor chains. */
+  };
+
+/* Entry in the used ring. */
+struct vring_used_elem
+  {
+    uint32_t id;                /* Head of completed chain. */
+    uint32_t len;               /* Bytes the device wrote. */
+  };
+
+/* Ring of descriptor chains the device has finished with. */
+struct vring_used
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where the device puts the next entry. */
+    struct vring_used_elem ring[];
+  };
+
+/* Header that starts every request. */
+struct virtio_blk_req
+  {
+    uint32_t type;              /* VIRTIO_BLK_T_*. */
+    uint32_t reserved;
+    uint64_t sector;            /* First sector. */
+  };
+
+/* A virtio block device. */
+struct virtio_blk
+  {
+    char name[8];               /* Name, e.g. "vda". */
+    uint16_t io_base;           /* Base of legacy registers. */
+    uint8_t irq;                /* Interrupt line. */
+
+    struct lock lock;           /* Must acquire to issue a request. */
+    struct semaphore completion_wait;   /* Up'd by interrupt handler. */
+
+    /* Virtqueue 0, in physically contiguous pages. */
+    uint16_t queue_size;        /* Number of descriptors. */
+    struct vring_desc *desc;    /* Descriptor table. */
+    struct vring_avail *avail;  /* Available ring. */
+    volatile struct vring_used *used;   /* Used ring. */
+    uint16_t used_idx;          /* Used ring entries consumed. */
+
+    /* The request header and status byte, in one page so that
+       each is physically contiguous. */
+    struct virtio_blk_req *header;
+    volatile uint8_t *status;
+  };
+
+/* Devices found. */
+#define VIRTIO_BLK_MAX 4
+static struct virtio_blk disks[VIRTIO_BLK_MAX];
+static size_t disk_cnt;
+
+static struct block_operations virtio_blk_operations;
+
+static bool init_device (struct virtio_blk *, struct pci_device *);
+static void interrupt_handler (struct intr_frame *);
+
+/* Finds and registers virtio block devices. */
+void
+virtio_blk_init (void)
+{
+  bool irq_registered[16] = { false };
+  struct pci_device *p;
+
+  for (p = pci_first (); p != NULL; p = pci_next (p))
+    {
+      struct virtio_blk *d;
+      struct block *block;
+      uint64_t capacity;
+
+      if (p->vendor_id != VIRTIO_VENDOR_ID
+          || p->device_id != VIRTIO_BLK_DEVICE_ID)
+        continue;
+      if (disk_cnt >= VIRTIO_BLK_MAX)
+        {
+          printf ("virtio-blk: too many devices\n");
+          break;
+        }
+
+      d = &disks[disk_cnt];
+      snprintf (d->name, sizeof d->name, "vd%c", 'a' + (int) disk_cnt);
+      if (!init_device (d, p))
+        continue;
+      disk_cnt++;
+
+      /* Devices may share an interrupt line, so each line gets one
+         handler that checks every device. */
+      if (!irq_registered[d->irq])
+        {
+          intr_register_ext (0x20 + d->irq, interrupt_handler, "virtio-blk");
+          irq_registered[d->irq] = true;
+        }
+
+      capacity = inl (reg_capacity (d));
+      capacity |= (uint64_t) inl (reg_capacity (d) + 4) << 32;
+      if (capacity > BLOCK_SECTOR_MAX)
+        capacity = BLOCK_SECTOR_MAX;
+      block = block_register (d->name, BLOCK_RAW, "virtio", capacity,
+                              &virtio_blk_operations, d);
+      partition_scan (block);
+    }
+}
+
+/* Resets the device behind P, sets up its virtqueue, and fills in
+   D.  Returns true if successful, false on failure. */
+static bool
+init_device (struct virtio_blk *d, struct pci_device *p)
+{
+  size_t desc_size, avail_size, used_size, page_cnt;
+  uint8_t *queue;
+
+  d->io_base = pci_io_bar (p, 0);
+  d->irq = p->irq;
+  if (d->io_base == 0 || d->irq >= 16)
+    {
+      printf ("%s: no I/O ports or interrupt\n", d->name);
+      return false;
+    }
+  pci_enable_bus_master (p);
+
+  /* Reset, then say hello.  We use none of the optional
+     features. */
+  outb (reg_status (d), 0);
+  outb (reg_status (d), STATUS_ACKNOWLEDGE);
+  outb (reg_status (d), STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+  outl (reg_guest_features (d), 0);
+
+  /* Size and allocate virtqueue 0. */
+  outw (reg_queue_select (d), 0);
+  d->queue_size = inw (reg_queue_size (d));
+  if (d->queue_size < 3)
+    {
+      printf ("%s: virtqueue too small\n", d->name);
+      outb (reg_status (d), STATUS_FAILED);
+      return false;
+    }
+  desc_size = sizeof *d->desc * d->queue_size;
+  avail_size = sizeof *d->avail + sizeof *d->avail->ring * (d->queue_size + 1);
+  used_size = (sizeof *d->used
+               + sizeof *d->used->ring * d->queue_size + sizeof (uint16_t));
+  page_cnt = (DIV_ROUND_UP (ROUND_UP (desc_size + avail_size, VRING_ALIGN)
+                            + used_size, PGSIZE));
+  queue = palloc_get_multiple (PAL_ZERO, page_cnt);
+  d->header = palloc_get_page (PAL_ZERO);
+  if (queue == NULL || d->header == NULL)
+    {
+      printf ("%s: out of memory for virtqueue\n", d->name);
+      outb (reg_status (d), STATUS_FAILED);
+      return false;
+    }
+  d->desc = (struct vring_desc *) queue;
+  d->avail = (struct vring_avail *) (queue + desc_size);
+  d->used = (struct vring_used *) (queue + ROUND_UP (desc_size + avail_size,
+                                                     VRING_ALIGN));
+  d->used_idx = 0;
+  d->status = (uint8_t *) (d->header + 1);
+
+  lock_init (&d->lock);
+  sema_init (&d->completion_wait, 0);
+
+  outl (reg_queue_pfn (d), vtop (queue) / PGSIZE);
+  outb (reg_status (d),
+        STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+  return true;
+}
+
+/* Transfers the CNT sectors starting at SECTOR between device D
+   and BUFFER, reading into BUFFER if WRITE is false and writing
+   from it otherwise.  Each request is a chain of three
+   descriptors: the header, the data, and the status byte.  Only
+   one request is outstanding at a time, so the chain always
+   occupies descriptors 0 through 2. */
+static void
+transfer (struct virtio_blk *d, block_sector_t sector, block_sector_t cnt,
+          const void *buffer, bool write)
+{
+  const uint8_t *p = buffer;
+
+  ASSERT (is_kernel_vaddr (buffer));
+
+  lock_acquire (&d->lock);
+  while (cnt > 0)
+    {
+      block_sector_t n = (cnt < VIRTIO_BLK_MAX_SECTORS
+                          ? cnt : VIRTIO_BLK_MAX_SECTORS);
+
+      d->header->type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+      d->header->reserved = 0;
+      d->header->sector = sector;
+      *d->status = 0xff;
+
+      d->desc[0].addr = vtop (d->header);
+      d->desc[0].len = sizeof *d->header;
+      d->desc[0].flags = DESC_NEXT;
+      d->desc[0].next = 1;
+      d->desc[1].addr = vtop (p);
+      d->desc[1].len = n * BLOCK_SECTOR_SIZE;
+      d->desc[1].flags = DESC_NEXT | (write ? 0 : DESC_WRITE);
+      d->desc[1].next = 2;
+      d->desc[2].addr = vtop ((const void *) d->status);
+      d->desc[2].len = 1;
+      d->desc[2].flags = DESC_WRITE;
+      d->desc[2].next = 0;
+
+      /* Publish the chain, then its index, then tell the
+         device. */
+      d->avail->ring[d->avail->idx % d->queue_size] = 0;
+      barrier ();
+      d->avail->idx++;
+      barrier ();
+      outw (reg_queue_notify (d), 0);
+
+      while (d->used->idx == d->used_idx)
+        sema_down (&d->completion_wait);
+      d->used_idx++;
+      if (*d->status != VIRTIO_BLK_S_OK)
+        PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+               d->name, write ? "write" : "read", sector);
+
+      p += n * BLOCK_SECTOR_SIZE;
+      sector += n;
+      cnt -= n;
+    }
+  lock_release (&d->lock);
+}
+
+/* Reads the CNT sectors starting at SECTOR from device D_ into
+   BUFFER, which must be a kernel address. */
+static void
+virtio_blk_read_multiple (void *d_, block_sector_t sector,
+                          block_sector_t cnt, void *buffer)
+{
+  transfer (d_, sector, cnt, buffer, false);
+}
+
+/* Writes the CNT sectors starting at SECTOR to device D_ from
+   BUFFER, which must be a kernel address. */
+static void
+virtio_blk_write_multiple (void *d_, block_sector_t sector,
+                           block_sector_t cnt, const void *buffer)
+{
+  transfer (d_, sector, cnt, buffer, true);
+}
+
+/* Reads sector SECTOR from device D_ into BUFFER. */
+static void
+virtio_blk_read (void *d_, block_sector_t sector, void *buffer)
+{
+  transfer (d_, sector, 1, buffer, false);
+}
+
+/* Writes sector SECTOR to device D_ from BUFFER. */
+static void
+virtio_blk_write (void *d_, block_sector_t sector, const void *buffer)
+{
+  transfer (d_, sector, 1, buffer, true);
+}
+
+static struct block_operations virtio_blk_operations =
+  {
+    virtio_blk_read,
+    virtio_blk_write,
+    virtio_blk_read_multiple,
+    virtio_blk_write_multiple,
+    NULL
+  };
+
+/* virtio interrupt handler.  Reading a device's ISR register
+   acknowledges its interrupt and says whether it raised one. */
+static void
+interrupt_handler (struct intr_frame *f)
+{
+  size_t i;
+
+  for (i = 0; i < disk_cnt; i++)
+    {
+      struct virtio_blk *d = &disks[i];
+      if (f->vec_no == 0x20u + d->irq && (inb (reg_isr (d)) & 1) != 0)
+        sema_up (&d->completion_wait);
+    }
+}
@@ -0,0 +1,364 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "devices/timer.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Milliseconds between runs of the write-behind thread. */
+#define CACHE_FLUSH_MSECS 5000
+
+/* Sector number of an unused cache entry. */
+#define CACHE_NO_SECTOR ((block_sector_t) -1)
+
+/* A cached sector of the file system device.
+
+   SECTOR, PIN_CNT, ACCESSED, EVICTING, OLD_SECTOR and LOGGED are
+   protected by cache_lock.  VALID, DIRTY and DATA are protected
+   by the entry's own LOCK, which may only be acquired by a
+   thread that has pinned the entry.  An entry with a nonzero
+   PIN_CNT is never chosen for eviction, so its SECTOR cannot
+   change underneath the threads that use it.  LOGGED is only
+   changed with both locks held, so either suffices to read it. */
+struct cache_entry
+  {
+    block_sector_t sector;              /* Sector cached here. */
+    int pin_cnt;                        /* Threads using this entry. */
+    bool accessed;                      /* Used since clock hand passed? */
+    bool evicting;                      /* Writing back OLD_SECTOR? */
+    block_sector_t old_sector;          /* Sector being written back. */
+    bool logged;                        /* Held for the journal? */
+
+    struct lock lock;                   /* Protects the members below. */
+    bool valid;                         /* DATA holds SECTOR's contents? */
+    bool dirty;                         /* DATA newer than the disk? */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+static struct lock cache_lock;          /* Protects the sector mapping. */
+static struct condition cache_changed;  /* Entry unpinned or written back. */
+static size_t clock_hand;               /* Next eviction candidate. */
+
+/* Read-ahead requests waiting for the read-ahead thread, kept in
+   a circular queue.  Requests that do not fit are dropped, since
+   read-ahead is only a hint. */
+#define CACHE_RA_QUEUE 32
+static block_sector_t ra_queue[CACHE_RA_QUEUE];
+static size_t ra_head;                  /* Index of oldest request. */
+static size_t ra_cnt;                   /* Number of queued requests. */
+static struct lock ra_lock;             /* Protects the queue. */
+static struct condition ra_nonempty;    /* Signaled when queue grows. */
+
+static thread_func flush_daemon NO_RETURN;
+static thread_func readahead_daemon NO_RETURN;
+
+/* Initializes the buffer cache and starts the write-behind and
+   read-ahead threads. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  lock_init (&cache_lock);
+  cond_init (&cache_changed);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      e->sector = CACHE_NO_SECTOR;
+      e->pin_cnt = 0;
+      e->accessed = false;
+      e->evicting = false;
+      e->logged = false;
+      lock_init (&e->lock);
+      e->valid = false;
+      e->dirty = false;
+    }
+  clock_hand = 0;
+
+  lock_init (&ra_lock);
+  cond_init (&ra_nonempty);
+  ra_head = ra_cnt = 0;
+
+  thread_create ("cache-flush", PRI_DEFAULT, flush_daemon, NULL);
+  thread_create ("cache-readahead", PRI_DEFAULT, readahead_daemon, NULL);
+}
+
+/* Returns the entry that caches SECTOR, or a null pointer.
+   Sets *BUSY to true if SECTOR is still being written back from
+   an entry that is being reused.  cache_lock must be held. */
+static struct cache_entry *
+lookup (block_sector_t sector, bool *busy)
+{
+  size_t i;
+
+  *busy = false;
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      if (e->sector == sector)
+        return e;
+      if (e->evicting && e->old_sector == sector)
+        *busy = true;
+    }
+  return NULL;
+}
+
+/* Chooses an unpinned entry to reuse with the clock algorithm,
+   giving every recently used entry a second chance.  Entries
+   held for the journal are skipped like pinned ones.  Returns a
+   null pointer if every entry is pinned.  cache_lock must be
+   held. */
+static struct cache_entry *
+choose_victim (void)
+{
+  size_t i;
+
+  for (i = 0; i < 2 * CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % CACHE_SIZE;
+      if (e->pin_cnt > 0 || e->evicting || e->logged)
+        continue;
+      if (e->sector == CACHE_NO_SECTOR || !e->accessed)
+        return e;
+      e->accessed = false;
+    }
+  return NULL;
+}
+
+/* Returns the entry for SECTOR, pinned and with its lock held,
+   bringing SECTOR into the cache if necessary.  If READ is false
+   the caller is about to overwrite the whole sector, so a newly
+   cached sector is not read from disk. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool read)
+{
+  struct cache_entry *e;
+  block_sector_t old_sector;
+  bool busy, writeback;
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      e = lookup (sector, &busy);
+      if (e != NULL)
+        {
+          /* Hit.  Pinning keeps E mapped to SECTOR until we are
+             done; if E is still being filled, its lock makes us
+             wait for the data. */
+          e->pin_cnt++;
+          e->accessed = true;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          break;
+        }
+
+      if (!busy && (e = choose_victim ()) != NULL)
+        {
+          /* Miss.  Nobody holds E's lock, because nobody has it
+             pinned, so this cannot block. */
+          lock_acquire (&e->lock);
+          writeback = e->valid && e->dirty;
+          old_sector = e->sector;
+          e->evicting = writeback;
+          e->old_sector = old_sector;
+          e->sector = sector;
+          e->pin_cnt = 1;
+          e->accessed = true;
+          lock_release (&cache_lock);
+
+          if (writeback)
+            {
+              block_write (fs_device, old_sector, e->data);
+              lock_acquire (&cache_lock);
+              e->evicting = false;
+              cond_broadcast (&cache_changed, &cache_lock);
+              lock_release (&cache_lock);
+            }
+          e->dirty = false;
+          e->valid = false;
+          break;
+        }
+
+      /* Every entry is pinned, or SECTOR's old contents are on
+         their way to disk.  Wait and try again. */
+      cond_wait (&cache_changed, &cache_lock);
+    }
+
+  if (!e->valid && read)
+    {
+      block_read (fs_device, sector, e->data);
+      e->valid = true;
+    }
+  return e;
+}
+
+/* Releases E's lock and unpins it. */
+static void
+cache_put (struct cache_entry *e)
+{
+  lock_release (&e->lock);
+  lock_acquire (&cache_lock);
+  if (--e->pin_cnt == 0)
+    cond_broadcast (&cache_changed, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Reads SIZE bytes starting at byte offset OFS within SECTOR of
+   the file system device into BUFFER. */
+void
+cache_read (block_sector_t sector, void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true);
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR of the file system
+   device, starting at byte offset OFS within the sector.  The
+   data reaches the disk later, when the sector is evicted or
+   flushed. */
+void
+cache_write (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  e->valid = true;
+  e->dirty = true;
+  cache_put (e);
+}
+
+/* Like cache_write(), but also holds SECTOR in the cache, never
+   to be written back, until cache_install() is called for it.
+   Used by the journal, which must write the new contents to the
+   log before they may reach SECTOR itself. */
+void
+cache_write_logged (block_sector_t sector, const void *buffer,
+                    int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  e->valid = true;
+  e->dirty = true;
+  lock_acquire (&cache_lock);
+  e->logged = true;
+  lock_release (&cache_lock);
+  cache_put (e);
+}
+
+/* Writes SECTOR, which must have been written with
+   cache_write_logged(), back to disk and lets it be evicted and
+   flushed normally again. */
+void
+cache_install (block_sector_t sector)
+{
+  struct cache_entry *e = cache_get (sector, true);
+
+  ASSERT (e->logged);
+  if (e->dirty)
+    {
+      block_write (fs_device, sector, e->data);
+      e->dirty = false;
+    }
+  lock_acquire (&cache_lock);
+  e->logged = false;
+  lock_release (&cache_lock);
+  cache_put (e);
+}
+
+/* Writes every dirty cached sector back to disk, except those
+   held for the journal. */
+void
+cache_flush (void)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      lock_acquire (&cache_lock);
+      if (e->sector == CACHE_NO_SECTOR || e->evicting || e->logged)
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      e->pin_cnt++;
+      lock_release (&cache_lock);
+
+      lock_acquire (&e->lock);
+      if (e->valid && e->dirty && !e->logged)
+        {
+          block_write (fs_device, e->sector, e->data);
+          e->dirty = false;
+        }
+      cache_put (e);
+    }
+}
+
+/* Write-behind thread.  Periodically flushes the cache so that
+   dirty data does not sit in memory indefinitely. */
+static void
+flush_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_msleep (CACHE_FLUSH_MSECS);
+      cache_flush ();
+    }
+}
+
+/* Asks the read-ahead thread to bring SECTOR into the cache in
+   the background.  Returns without waiting for the disk. */
+void
+cache_readahead (block_sector_t sector)
+{
+  size_t i;
+
+  lock_acquire (&ra_lock);
+  for (i = 0; i < ra_cnt; i++)
+    if (ra_queue[(ra_head + i) % CACHE_RA_QUEUE] == sector)
+      break;
+  if (i == ra_cnt && ra_cnt < CACHE_RA_QUEUE)
+    {
+      ra_queue[(ra_head + ra_cnt) % CACHE_RA_QUEUE] = sector;
+      ra_cnt++;
+      cond_signal (&ra_nonempty, &ra_lock);
+    }
+  lock_release (&ra_lock);
+}
+
+/* Read-ahead thread.  Fetches queued sectors into the cache so
+   that sequential readers find them there. */
+static void
+readahead_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t sector;
+
+      lock_acquire (&ra_lock);
+      while (ra_cnt == 0)
+        cond_wait (&ra_nonempty, &ra_lock);
+      sector = ra_queue[ra_head];
+      ra_head = (ra_head + 1) % CACHE_RA_QUEUE;
+      ra_cnt--;
+      lock_release (&ra_lock);
+
+      cache_put (cache_get (sector, true));
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include "devices/block.h"
+
+/* Number of sectors held in the buffer cache. */
+#define CACHE_SIZE 64
+
+void cache_init (void);
+void cache_read (block_sector_t, void *buffer, int ofs, int size);
+void cache_write (block_sector_t, const void *buffer, int ofs, int size);
+void cache_write_logged (block_sector_t, const void *buffer, int ofs,
+                         int size);
+void cache_install (block_sector_t);
+void cache_flush (void);
+void cache_readahead (block_sector_t);
+
+#endif /* filesys/cache.h */
@@ -0,0 +1,208 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Cache of directory lookups.
+
+   Each entry records the result of looking up NAME in the
+   directory whose inode is in sector DIR: either the sector of
+   the file's inode or, for a negative entry, the fact that there
+   is no such file.  Entries are found through a hash table keyed
+   on DIR and the hash of NAME, and the least recently used entry
+   is discarded once there are DCACHE_SIZE of them.
+
+   The cache is kept coherent by directory.c, which invalidates
+   an entry whenever it adds or removes the name and purges
+   everything under a directory's sector when a new directory is
+   created there. */
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* Element in dcache. */
+    struct list_elem lru_elem;          /* Element in lru_list. */
+    block_sector_t dir;                 /* Containing directory. */
+    char name[NAME_MAX + 1];            /* File name. */
+    block_sector_t inode_sector;        /* File's inode, if positive. */
+    bool negative;                      /* No such file? */
+  };
+
+static struct hash dcache;
+static struct list lru_list;            /* Most recently used first. */
+static struct lock dcache_lock;         /* Protects everything above. */
+
+/* Statistics. */
+static unsigned long long hit_cnt;      /* Lookups answered. */
+static unsigned long long negative_cnt; /* ...of which negative. */
+static unsigned long long miss_cnt;     /* Lookups not answered. */
+
+static hash_hash_func dentry_hash;
+static hash_less_func dentry_less;
+
+/* Initializes the directory entry cache. */
+void
+dcache_init (void)
+{
+  hash_init (&dcache, dentry_hash, dentry_less, NULL);
+  list_init (&lru_list);
+  lock_init (&dcache_lock);
+}
+
+/* Returns the entry for NAME in DIR, or a null pointer if there
+   is none.  The caller must hold dcache_lock. */
+static struct dentry *
+find (block_sector_t dir, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dcache, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Removes D from the cache and frees it.  The caller must hold
+   dcache_lock. */
+static void
+discard (struct dentry *d)
+{
+  hash_delete (&dcache, &d->hash_elem);
+  list_remove (&d->lru_elem);
+  free (d);
+}
+
+/* Looks up NAME in directory DIR.  If the cache knows the
+   answer, returns true and sets *INODE_SECTOR to the sector of
+   the file's inode, or to 0 if there is no such file.  Otherwise
+   returns false, and the caller should search the directory and
+   record the answer with dcache_insert(). */
+bool
+dcache_lookup (block_sector_t dir, const char *name,
+               block_sector_t *inode_sector)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return false;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    {
+      list_remove (&d->lru_elem);
+      list_push_front (&lru_list, &d->lru_elem);
+      *inode_sector = d->negative ? 0 : d->inode_sector;
+      hit_cnt++;
+      if (d->negative)
+        negative_cnt++;
+    }
+  else
+    miss_cnt++;
+  lock_release (&dcache_lock);
+
+  return d != NULL;
+}
+
+/* Records that NAME in directory DIR has its inode in
+   INODE_SECTOR, or that it does not exist if INODE_SECTOR is
+   0. */
+void
+dcache_insert (block_sector_t dir, const char *name,
+               block_sector_t inode_sector)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d == NULL)
+    {
+      if (hash_size (&dcache) >= DCACHE_SIZE)
+        discard (list_entry (list_back (&lru_list),
+                             struct dentry, lru_elem));
+      d = malloc (sizeof *d);
+      if (d == NULL)
+        goto done;
+      d->dir = dir;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dcache, &d->hash_elem);
+    }
+  else
+    list_remove (&d->lru_elem);
+  list_push_front (&lru_list, &d->lru_elem);
+  d->inode_sector = inode_sector;
+  d->negative = inode_sector == 0;
+
+ done:
+  lock_release (&dcache_lock);
+}
+
+/* Forgets anything known about NAME in directory DIR. */
+void
+dcache_invalidate (block_sector_t dir, const char *name)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    discard (d);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets every entry in directory DIR, whose inode sector is
+   being reused for a new directory. */
+void
+dcache_purge_dir (block_sector_t dir)
+{
+  struct list_elem *e, *next;
+
+  lock_acquire (&dcache_lock);
+  for (e = list_begin (&lru_list); e != list_end (&lru_list); e = next)
+    {
+      struct dentry *d = list_entry (e, struct dentry, lru_elem);
+      next = list_next (e);
+      if (d->dir == dir)
+        discard (d);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Prints directory entry cache statistics. */
+void
+dcache_print_stats (void)
+{
+  printf ("Dcache: %llu hits (%llu negative), %llu misses\n",
+          hit_cnt, negative_cnt, miss_cnt);
+}
+
+/* Returns a hash value for dentry E. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+/* Returns true if dentry A precedes dentry B. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
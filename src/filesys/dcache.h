@@ -0,0 +1,19 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Maximum number of cached directory entries. */
+#define DCACHE_SIZE 256
+
+void dcache_init (void);
+bool dcache_lookup (block_sector_t dir, const char *name,
+                    block_sector_t *inode_sector);
+void dcache_insert (block_sector_t dir, const char *name,
+                    block_sector_t inode_sector);
+void dcache_invalidate (block_sector_t dir, const char *name);
+void dcache_purge_dir (block_sector_t dir);
+void dcache_print_stats (void);
+
+#endif /* filesys/dcache.h */
@@ -1,11 +1,60 @@
 #include "filesys/directory.h"
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <hash.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "filesys/inode.h"
+#include "filesys/log.h"
 #include "threads/malloc.h"
 
+/* Directories are hashed, in the style of ext3's htree.
+
+   A directory file is a sequence of sector-sized blocks.  Block
+   0 is the root of a hash index.  Every index node holds slots
+   sorted by hash; a slot covers the hashes from its own HASH up
+   to the next slot's HASH and points to the block below it.
+   Below the root there are DEPTH levels of further index nodes
+   and then leaf blocks, each holding up to LEAF_ENTRIES
+   directory entries whose names hash into the leaf's range.
+
+   Looking a name up therefore reads one block per index level
+   and a single leaf, whatever the size of the directory.  When a
+   leaf fills up it is split in two by hash, adding a slot to its
+   parent, and full index nodes split the same way.  When the
+   root fills up the tree grows by one level. */
+
+/* Block types. */
+#define DX_NODE_MAGIC 0x4458444e        /* Index node. */
+#define DIR_LEAF_MAGIC 0x4c454146       /* Leaf. */
+
+/* A slot in an index node. */
+struct dx_slot
+  {
+    uint32_t hash;                      /* Smallest hash covered. */
+    uint32_t block;                     /* Block covering the hashes. */
+  };
+
+/* Number of slots in an index node. */
+#define DX_SLOTS 62
+
+/* Largest number of index levels below the root. */
+#define DX_MAX_DEPTH 1
+
+/* An index node.  DEPTH and PARENT are meaningful only in the
+   root, block 0. */
+struct dx_node
+  {
+    uint32_t type;                      /* DX_NODE_MAGIC. */
+    uint32_t cnt;                       /* Slots in use. */
+    uint32_t depth;                     /* Index levels below root. */
+    block_sector_t parent;              /* Parent directory's inode. */
+    struct dx_slot slots[DX_SLOTS];     /* Slots, sorted by hash. */
+  };
+
 /* A directory. */
 struct dir
   {
@@ -21,12 +70,205 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
-/* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+/* Number of entries in a leaf. */
+#define LEAF_ENTRIES 25
+
+/* A leaf block. */
+struct dir_leaf
+  {
+    uint32_t type;                      /* DIR_LEAF_MAGIC. */
+    uint32_t unused;                    /* Not used. */
+    struct dir_entry entries[LEAF_ENTRIES];     /* Entries. */
+    uint8_t pad[4];                     /* Not used. */
+  };
+
+/* Path from the root of the index down to a leaf. */
+struct dx_path
+  {
+    int levels;                         /* Number of index nodes. */
+    uint32_t node[DX_MAX_DEPTH + 1];    /* Index node at each level. */
+    uint32_t slot[DX_MAX_DEPTH + 1];    /* Slot followed in each node. */
+    uint32_t leaf;                      /* Leaf reached. */
+  };
+
+/* Returns the hash used to index NAME. */
+static uint32_t
+name_hash (const char *name)
+{
+  return hash_string (name);
+}
+
+/* Reads block BLOCK of DIR into BUF, which must have room for
+   BLOCK_SECTOR_SIZE bytes.  Returns true if successful. */
+static bool
+read_block (const struct dir *dir, uint32_t block, void *buf)
+{
+  return inode_read_at (dir->inode, buf, BLOCK_SECTOR_SIZE,
+                        block * BLOCK_SECTOR_SIZE) == BLOCK_SECTOR_SIZE;
+}
+
+/* Writes BUF, which must hold BLOCK_SECTOR_SIZE bytes, to block
+   BLOCK of DIR.  Returns true if successful. */
+static bool
+write_block (struct dir *dir, uint32_t block, const void *buf)
+{
+  return inode_write_at (dir->inode, buf, BLOCK_SECTOR_SIZE,
+                         block * BLOCK_SECTOR_SIZE) == BLOCK_SECTOR_SIZE;
+}
+
+/* Returns the number of the block that would be appended to
+   DIR next. */
+static uint32_t
+next_block (const struct dir *dir)
+{
+  return inode_length (dir->inode) / BLOCK_SECTOR_SIZE;
+}
+
+/* Returns the index of the slot in NODE that covers HASH. */
+static uint32_t
+dx_search (const struct dx_node *node, uint32_t hash)
+{
+  uint32_t lo = 0, hi = node->cnt;
+
+  /* Find the last slot whose hash is at most HASH.  Slot 0
+     always starts at hash 0. */
+  while (hi - lo > 1)
+    {
+      uint32_t mid = (lo + hi) / 2;
+      if (node->slots[mid].hash <= hash)
+        lo = mid;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+/* Walks DIR's index from the root to the leaf covering HASH,
+   recording the way in *PATH.  NODE is scratch space.  Returns
+   true if successful, false on a read error or a damaged
+   index. */
+static bool
+dx_walk (const struct dir *dir, uint32_t hash, struct dx_path *path,
+         struct dx_node *node)
+{
+  uint32_t block = 0;
+  uint32_t depth = 0;
+  int level;
+
+  for (level = 0; level <= (int) depth; level++)
+    {
+      if (!read_block (dir, block, node)
+          || node->type != DX_NODE_MAGIC || node->cnt == 0)
+        return false;
+      if (level == 0)
+        {
+          depth = node->depth;
+          if (depth > DX_MAX_DEPTH)
+            return false;
+        }
+      path->node[level] = block;
+      path->slot[level] = dx_search (node, hash);
+      block = node->slots[path->slot[level]].block;
+    }
+  path->levels = level;
+  path->leaf = block;
+  return true;
+}
+
+/* Searches DIR for a file with the given NAME.
+   If successful, returns true, sets *EP to the directory entry
+   if EP is non-null, and sets *OFSP to the byte offset of the
+   directory entry if OFSP is non-null.
+   otherwise, returns false and ignores EP and OFSP. */
+static bool
+lookup (const struct dir *dir, const char *name,
+        struct dir_entry *ep, off_t *ofsp)
+{
+  struct dx_path path;
+  struct dir_leaf *leaf;
+  bool found = false;
+  size_t i;
+
+  ASSERT (dir != NULL);
+  ASSERT (name != NULL);
+
+  /* Index nodes and leaves are the same size, so one buffer
+     serves for both. */
+  ASSERT (sizeof (struct dx_node) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct dir_leaf) == BLOCK_SECTOR_SIZE);
+  leaf = malloc (BLOCK_SECTOR_SIZE);
+  if (leaf == NULL)
+    return false;
+
+  if (dx_walk (dir, name_hash (name), &path, (struct dx_node *) leaf)
+      && read_block (dir, path.leaf, leaf)
+      && leaf->type == DIR_LEAF_MAGIC)
+    for (i = 0; i < LEAF_ENTRIES; i++)
+      {
+        struct dir_entry *e = &leaf->entries[i];
+        if (e->in_use && !strcmp (name, e->name))
+          {
+            if (ep != NULL)
+              *ep = *e;
+            if (ofsp != NULL)
+              *ofsp = (path.leaf * BLOCK_SECTOR_SIZE
+                       + offsetof (struct dir_leaf, entries[i]));
+            found = true;
+            break;
+          }
+      }
+  free (leaf);
+  return found;
+}
+
+/* Creates an empty directory in the given SECTOR, whose parent
+   directory's inode is in PARENT_SECTOR.  Returns true if
+   successful, false on failure.  On failure, SECTOR is released
+   in the free map along with anything else allocated for the
+   directory, so the caller must not release it again. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, block_sector_t parent_sector)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct dx_node *root = NULL;
+  struct dir_leaf *leaf = NULL;
+  struct dir *dir = NULL;
+  bool success = false;
+
+  if (!inode_create (sector, 0, true))
+    {
+      free_map_release (sector, 1);
+      return false;
+    }
+
+  /* SECTOR may have held a directory before. */
+  dcache_purge_dir (sector);
+
+  root = calloc (1, sizeof *root);
+  leaf = calloc (1, sizeof *leaf);
+  dir = dir_open (inode_open (sector));
+  if (root != NULL && leaf != NULL && dir != NULL)
+    {
+      root->type = DX_NODE_MAGIC;
+      root->cnt = 1;
+      root->depth = 0;
+      root->parent = parent_sector;
+      root->slots[0].hash = 0;
+      root->slots[0].block = 1;
+      leaf->type = DIR_LEAF_MAGIC;
+      success = write_block (dir, 0, root) && write_block (dir, 1, leaf);
+    }
+
+  /* Removing the inode releases its data and SECTOR when it is
+     closed.  If it could not be opened, nothing has been written
+     to it, so only SECTOR is left to release. */
+  if (!success && dir != NULL)
+    inode_remove (dir->inode);
+  else if (!success)
+    free_map_release (sector, 1);
+  dir_close (dir);
+  free (leaf);
+  free (root);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -83,38 +325,23 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
-   If successful, returns true, sets *EP to the directory entry
-   if EP is non-null, and sets *OFSP to the byte offset of the
-   directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
-static bool
-lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp)
+/* Returns the sector of the inode of DIR's parent directory, or
+   0 if it cannot be read.  The root is its own parent. */
+static block_sector_t
+parent_sector (const struct dir *dir)
 {
-  struct dir_entry e;
-  size_t ofs;
-
-  ASSERT (dir != NULL);
-  ASSERT (name != NULL);
-
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (e.in_use && !strcmp (name, e.name))
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
-  return false;
+  block_sector_t parent;
+  if (inode_read_at (dir->inode, &parent, sizeof parent,
+                     offsetof (struct dx_node, parent)) != sizeof parent)
+    return 0;
+  return parent;
 }
 
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   "." names DIR itself and ".." its parent. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode)
@@ -124,14 +351,225 @@ dir_lookup (const struct dir *dir, const char *name,
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  if (!strcmp (name, "."))
+    *inode = inode_reopen (dir->inode);
+  else if (!strcmp (name, ".."))
+    {
+      block_sector_t parent = parent_sector (dir);
+      *inode = parent != 0 ? inode_open (parent) : NULL;
+    }
   else
-    *inode = NULL;
+    {
+      block_sector_t dir_sector = inode_get_inumber (dir->inode);
+      block_sector_t sector;
+
+      /* Holding the directory lock keeps the entry, and so the
+         file's inode sector, from going away before the inode is
+         open, and keeps a stale answer out of the dcache. */
+      inode_lock_dir (dir->inode, false);
+      if (!dcache_lookup (dir_sector, name, &sector))
+        {
+          sector = lookup (dir, name, &e, NULL) ? e.inode_sector : 0;
+          dcache_insert (dir_sector, name, sector);
+        }
+      *inode = sector != 0 ? inode_open (sector) : NULL;
+      inode_unlock_dir (dir->inode, false);
+    }
 
   return *inode != NULL;
 }
 
+/* Returns true if a leaf can be split in DIR along PATH, that is,
+   if some index node on PATH has a free slot or the tree can
+   still grow a level.  NODE is scratch space. */
+static bool
+dx_can_split (const struct dir *dir, const struct dx_path *path,
+              struct dx_node *node)
+{
+  int level;
+
+  for (level = 0; level < path->levels; level++)
+    {
+      if (!read_block (dir, path->node[level], node))
+        return false;
+      if (node->cnt < DX_SLOTS)
+        return true;
+      if (level == 0 && node->depth < DX_MAX_DEPTH)
+        return true;
+    }
+  return false;
+}
+
+/* Inserts a slot for HASH, pointing to BLOCK, into the index node
+   at LEVEL of PATH, just after the slot that PATH followed there.
+   Splits full index nodes and grows the tree as needed; the
+   caller must have checked dx_can_split() first.  NODE is
+   scratch space.  Returns true if successful. */
+static bool
+dx_insert (struct dir *dir, struct dx_path *path, int level,
+           uint32_t hash, uint32_t block, struct dx_node *node)
+{
+  uint32_t pos = path->slot[level] + 1;
+  uint32_t node_block = path->node[level];
+  struct dx_node *sibling;
+  uint32_t sibling_block, half;
+  bool success;
+
+  if (!read_block (dir, node_block, node))
+    return false;
+
+  if (node->cnt < DX_SLOTS)
+    {
+      /* Room in this node. */
+      memmove (&node->slots[pos + 1], &node->slots[pos],
+               (node->cnt - pos) * sizeof *node->slots);
+      node->slots[pos].hash = hash;
+      node->slots[pos].block = block;
+      node->cnt++;
+      return write_block (dir, node_block, node);
+    }
+
+  sibling = calloc (1, sizeof *sibling);
+  if (sibling == NULL)
+    return false;
+  sibling_block = next_block (dir);
+
+  if (level == 0)
+    {
+      /* The root is full.  Move its slots down into a new node
+         and make that the root's only child, one level deeper,
+         then insert there. */
+      int i;
+
+      *sibling = *node;
+      sibling->depth = 0;
+      sibling->parent = 0;
+      node->cnt = 1;
+      node->depth++;
+      node->slots[0].hash = 0;
+      node->slots[0].block = sibling_block;
+      success = (write_block (dir, sibling_block, sibling)
+                 && write_block (dir, 0, node));
+      free (sibling);
+      if (!success)
+        return false;
+
+      for (i = path->levels; i > 0; i--)
+        {
+          path->node[i] = path->node[i - 1];
+          path->slot[i] = path->slot[i - 1];
+        }
+      path->node[1] = sibling_block;
+      path->slot[0] = 0;
+      path->levels++;
+      return dx_insert (dir, path, 1, hash, block, node);
+    }
+
+  /* Split this node, moving its upper half into SIBLING, and
+     put the new slot into whichever half it belongs in. */
+  half = node->cnt / 2;
+  sibling->type = DX_NODE_MAGIC;
+  sibling->cnt = node->cnt - half;
+  memcpy (sibling->slots, &node->slots[half],
+          sibling->cnt * sizeof *node->slots);
+  node->cnt = half;
+  if (pos >= half)
+    {
+      struct dx_node *target = sibling;
+      pos -= half;
+      memmove (&target->slots[pos + 1], &target->slots[pos],
+               (target->cnt - pos) * sizeof *target->slots);
+      target->slots[pos].hash = hash;
+      target->slots[pos].block = block;
+      target->cnt++;
+    }
+  else
+    {
+      memmove (&node->slots[pos + 1], &node->slots[pos],
+               (node->cnt - pos) * sizeof *node->slots);
+      node->slots[pos].hash = hash;
+      node->slots[pos].block = block;
+      node->cnt++;
+    }
+  hash = sibling->slots[0].hash;
+  success = (write_block (dir, sibling_block, sibling)
+             && write_block (dir, node_block, node));
+  free (sibling);
+
+  return success && dx_insert (dir, path, level - 1, hash, sibling_block,
+                               node);
+}
+
+/* Compares the hashes of the names in directory entries A and
+   B, for sorting. */
+static int
+compare_entry_hash (const struct dir_entry *a, const struct dir_entry *b)
+{
+  uint32_t ha = name_hash (a->name), hb = name_hash (b->name);
+  return ha < hb ? -1 : ha > hb;
+}
+
+/* Splits the full leaf LEAF, found along PATH, into two by hash,
+   adding a slot for the new leaf to the index.  NODE is scratch
+   space.  Returns true if successful, false if the leaf's
+   entries all share one hash, the index is full, or an error
+   occurs. */
+static bool
+split_leaf (struct dir *dir, struct dx_path *path, struct dir_leaf *leaf,
+            struct dx_node *node)
+{
+  struct dir_leaf *upper;
+  uint32_t upper_block, split_hash;
+  size_t i, j, mid;
+  bool success;
+
+  if (!dx_can_split (dir, path, node))
+    return false;
+
+  /* Sort the entries by hash (insertion sort; there are only
+     LEAF_ENTRIES of them) and split at the median, moving it up
+     past any entries that share its hash so that each hash lives
+     in exactly one leaf. */
+  for (i = 1; i < LEAF_ENTRIES; i++)
+    for (j = i; j > 0 && compare_entry_hash (&leaf->entries[j - 1],
+                                             &leaf->entries[j]) > 0; j--)
+      {
+        struct dir_entry tmp = leaf->entries[j];
+        leaf->entries[j] = leaf->entries[j - 1];
+        leaf->entries[j - 1] = tmp;
+      }
+  for (mid = LEAF_ENTRIES / 2; mid < LEAF_ENTRIES; mid++)
+    if (name_hash (leaf->entries[mid].name)
+        != name_hash (leaf->entries[mid - 1].name))
+      break;
+  if (mid == LEAF_ENTRIES)
+    for (mid = LEAF_ENTRIES / 2; mid > 0; mid--)
+      if (name_hash (leaf->entries[mid].name)
+          != name_hash (leaf->entries[mid - 1].name))
+        break;
+  if (mid == 0)
+    return false;
+  split_hash = name_hash (leaf->entries[mid].name);
+
+  upper = calloc (1, sizeof *upper);
+  if (upper == NULL)
+    return false;
+  upper->type = DIR_LEAF_MAGIC;
+  for (i = mid; i < LEAF_ENTRIES; i++)
+    {
+      upper->entries[i - mid] = leaf->entries[i];
+      leaf->entries[i].in_use = false;
+    }
+
+  upper_block = next_block (dir);
+  success = (write_block (dir, upper_block, upper)
+             && write_block (dir, path->leaf, leaf)
+             && dx_insert (dir, path, path->levels - 1, split_hash,
+                           upper_block, node));
+  free (upper);
+  return success;
+}
+
 /* Adds a file named NAME to DIR, which must not already contain a
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
@@ -141,46 +579,96 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
-  struct dir_entry e;
-  off_t ofs;
+  struct dx_path path;
+  struct dx_node *node = NULL;
+  struct dir_leaf *leaf = NULL;
+  uint32_t hash;
   bool success = false;
+  size_t i;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
   /* Check NAME for validity. */
-  if (*name == '\0' || strlen (name) > NAME_MAX)
+  if (*name == '\0' || strlen (name) > NAME_MAX
+      || !strcmp (name, ".") || !strcmp (name, ".."))
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  inode_lock_dir (dir->inode, true);
+
+  /* Check that DIR has not been removed and that NAME is not in
+     use. */
+  if (inode_is_removed (dir->inode) || lookup (dir, name, NULL, NULL))
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
+  node = malloc (sizeof *node);
+  leaf = malloc (sizeof *leaf);
+  if (node == NULL || leaf == NULL)
+    goto done;
 
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (!e.in_use)
-      break;
+  /* Find a free slot in the leaf that covers NAME's hash,
+     splitting the leaf until one turns up. */
+  hash = name_hash (name);
+  for (;;)
+    {
+      if (!dx_walk (dir, hash, &path, node)
+          || !read_block (dir, path.leaf, leaf)
+          || leaf->type != DIR_LEAF_MAGIC)
+        goto done;
+      for (i = 0; i < LEAF_ENTRIES; i++)
+        if (!leaf->entries[i].in_use)
+          break;
+      if (i < LEAF_ENTRIES)
+        break;
+      if (!split_leaf (dir, &path, leaf, node))
+        goto done;
+    }
 
   /* Write slot. */
-  e.in_use = true;
-  strlcpy (e.name, name, sizeof e.name);
-  e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
+  leaf->entries[i].in_use = true;
+  strlcpy (leaf->entries[i].name, name, sizeof leaf->entries[i].name);
+  leaf->entries[i].inode_sector = inode_sector;
+  success = (inode_write_at (dir->inode, &leaf->entries[i],
+                             sizeof leaf->entries[i],
+                             (path.leaf * BLOCK_SECTOR_SIZE
+                              + offsetof (struct dir_leaf, entries[i])))
+             == sizeof leaf->entries[i]);
 
  done:
+  inode_unlock_dir (dir->inode, true);
+  free (leaf);
+  free (node);
   return success;
 }
 
+static bool next_entry (struct dir *, char name[NAME_MAX + 1]);
+
+/* Returns true if DIR contains no entries.  The caller must hold
+   DIR's directory lock. */
+static bool
+dir_is_empty (struct dir *dir)
+{
+  char name[NAME_MAX + 1];
+  off_t pos = dir->pos;
+  bool empty;
+
+  dir->pos = 0;
+  empty = !next_entry (dir, name);
+  dir->pos = pos;
+  return empty;
+}
+
 /* Removes any entry for NAME in DIR.
    Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   which occurs if there is no file with the given NAME, or if
+   NAME is a directory that is not empty or is open elsewhere
+   (which includes being some process's working directory).
+
+   The entry is erased in a log operation begun before DIR's lock
+   is taken, the same order as dir_add()'s callers use.  If that
+   drops the last reference to the inode, its sectors are
+   released afterward, in operations of their own. */
 bool
 dir_remove (struct dir *dir, const char *name)
 {
@@ -192,6 +680,9 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  log_begin ();
+  inode_lock_dir (dir->inode, true);
+
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
     goto done;
@@ -201,7 +692,32 @@ dir_remove (struct dir *dir, const char *name)
   if (inode == NULL)
     goto done;
 
+  /* Only empty directories that nobody else is using may go.
+     The victim's own lock, taken after its parent's, keeps
+     entries from being added to it until it is marked removed,
+     after which dir_add() refuses. */
+  if (inode_is_dir (inode))
+    {
+      struct dir *victim;
+      bool removable;
+
+      if (inode_open_cnt (inode) > 1)
+        goto done;
+      victim = dir_open (inode_reopen (inode));
+      if (victim == NULL)
+        goto done;
+      inode_lock_dir (inode, true);
+      removable = dir_is_empty (victim);
+      if (removable)
+        inode_remove (inode);
+      inode_unlock_dir (inode, true);
+      dir_close (victim);
+      if (!removable)
+        goto done;
+    }
+
   /* Erase directory entry. */
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
     goto done;
@@ -211,20 +727,55 @@ dir_remove (struct dir *dir, const char *name)
   success = true;
 
  done:
+  inode_unlock_dir (dir->inode, true);
+  log_end ();
   inode_close (inode);
   return success;
 }
 
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
+   contains no more entries.  "." and ".." are never returned.
+   Entries are returned in index order, not sorted by name. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
+  bool success;
+
+  inode_lock_dir (dir->inode, false);
+  success = next_entry (dir, name);
+  inode_unlock_dir (dir->inode, false);
+  return success;
+}
+
+/* Does the work of dir_readdir() for a caller that holds DIR's
+   directory lock. */
+static bool
+next_entry (struct dir *dir, char name[NAME_MAX + 1])
+{
+  const off_t entries_ofs = offsetof (struct dir_leaf, entries);
+  const off_t entries_end = offsetof (struct dir_leaf, pad);
   struct dir_entry e;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e)
+  while (dir->pos < inode_length (dir->inode))
     {
+      off_t block_ofs = dir->pos - dir->pos % BLOCK_SECTOR_SIZE;
+      uint32_t type;
+
+      /* Skip index nodes and the unused ends of leaves. */
+      if (inode_read_at (dir->inode, &type, sizeof type, block_ofs)
+          != sizeof type)
+        break;
+      if (type != DIR_LEAF_MAGIC || dir->pos - block_ofs >= entries_end)
+        {
+          dir->pos = block_ofs + BLOCK_SECTOR_SIZE;
+          continue;
+        }
+      if (dir->pos - block_ofs < entries_ofs)
+        dir->pos = block_ofs + entries_ofs;
+
+      if (inode_read_at (dir->inode, &e, sizeof e, dir->pos) != sizeof e)
+        break;
       dir->pos += sizeof e;
       if (e.in_use)
         {
@@ -1,8 +1,14 @@
 #include "filesys/file.h"
 #include <debug.h>
 #include "filesys/inode.h"
+#include "devices/block.h"
 #include "threads/malloc.h"
 
+/* Read-ahead window limits, in bytes.  The window starts at
+   RA_MIN when a file is first read sequentially and doubles with
+   each further sequential read, up to RA_MAX. */
+#define RA_MIN (4 * BLOCK_SECTOR_SIZE)
+#define RA_MAX (32 * BLOCK_SECTOR_SIZE)
 
 /* An open file. */
 struct file
@@ -10,8 +16,15 @@ struct file
   struct inode *inode;        /* File's inode. */
   off_t pos;                  /* Current position. */
   bool deny_write;            /* Has file_deny_write() been called? */
+
+  /* Sequential read detection. */
+  off_t ra_next;              /* Offset a sequential read starts at. */
+  off_t ra_window;            /* Bytes to prefetch past each read. */
+  off_t ra_end;               /* End of data already prefetched. */
 };
 
+static void readahead (struct file *, off_t offset, off_t size);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -24,6 +37,9 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = 0;
+      file->ra_window = 0;
+      file->ra_end = 0;
       return file;
     }
   else
@@ -70,6 +86,7 @@ off_t
 file_read (struct file *file, void *buffer, off_t size)
 {
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  readahead (file, file->pos, bytes_read);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -82,15 +99,56 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  off_t bytes_read = inode_read_at (file->inode, buffer, size, file_ofs);
+  readahead (file, file_ofs, bytes_read);
+  return bytes_read;
+}
+
+/* Notes that SIZE bytes were just read from FILE at OFFSET.  If
+   the read continued where the previous one left off, grows
+   FILE's read-ahead window and asks the buffer cache to prefetch
+   the data that lies within the window past this read.  Any
+   other read shuts read-ahead off until reads become sequential
+   again. */
+static void
+readahead (struct file *file, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+  off_t start, limit;
+
+  if (size <= 0)
+    return;
+
+  if (offset == file->ra_next)
+    {
+      if (file->ra_window == 0)
+        file->ra_window = RA_MIN;
+      else if (file->ra_window < RA_MAX)
+        file->ra_window *= 2;
+    }
+  else
+    {
+      file->ra_window = 0;
+      file->ra_end = 0;
+    }
+  file->ra_next = end;
+
+  if (file->ra_window == 0)
+    return;
+  start = file->ra_end > end ? file->ra_end : end;
+  limit = end + file->ra_window;
+  if (start < limit)
+    {
+      inode_readahead (file->inode, start, limit - start);
+      file->ra_end = limit;
+    }
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk fills up.
+   Writing past end of file grows the file.
    Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size)
@@ -103,9 +161,8 @@ file_write (struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk fills up.
+   Writing past end of file grows the file.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
@@ -114,6 +171,67 @@ file_write_at (struct file *file, const void *buffer, off_t size,
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Copies up to SIZE bytes from SRC, starting at its current
+   position, to DST at its current position, advancing both
+   positions by the number of bytes copied, which is returned.
+   Fewer than SIZE bytes are copied if SRC ends or DST cannot
+   grow.  Returns -1, copying nothing, if SRC and DST are the
+   same file or memory is short.
+
+   The data never leaves the kernel.  It moves one sector at a
+   time through the buffer cache, in pieces aligned to DST's
+   sectors, so that each write covers a whole sector and the
+   cache need not read the sector's old contents first. */
+off_t
+file_copy (struct file *dst, struct file *src, off_t size)
+{
+  uint8_t *buffer;
+  off_t copied = 0;
+
+  if (dst->inode == src->inode)
+    return -1;
+  buffer = malloc (BLOCK_SECTOR_SIZE);
+  if (buffer == NULL)
+    return -1;
+
+  while (size > 0)
+    {
+      off_t chunk = BLOCK_SECTOR_SIZE - dst->pos % BLOCK_SECTOR_SIZE;
+      off_t bytes_read, bytes_written;
+
+      if (chunk > size)
+        chunk = size;
+      bytes_read = file_read (src, buffer, chunk);
+      if (bytes_read == 0)
+        break;
+      bytes_written = file_write (dst, buffer, bytes_read);
+      copied += bytes_written;
+      size -= bytes_written;
+      if (bytes_written < bytes_read)
+        {
+          /* Leave SRC just past the last byte copied. */
+          src->pos -= bytes_read - bytes_written;
+          break;
+        }
+      if (bytes_read < chunk)
+        break;
+    }
+
+  free (buffer);
+  return copied;
+}
+
+/* Reserves space for SIZE bytes of FILE starting at offset
+   FILE_OFS, growing the file if necessary, without writing any
+   data.  The reserved bytes read as zeros until written.
+   Returns true if successful, false if the disk fills up.
+   The file's current position is unaffected. */
+bool
+file_allocate (struct file *file, off_t file_ofs, off_t size)
+{
+  return inode_allocate (file->inode, file_ofs, size);
+}
+
 /* Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
@@ -2,10 +2,15 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
+#include "filesys/log.h"
+#include "filesys/orphan.h"
 #include "filesys/directory.h"
+#include "threads/thread.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
@@ -21,13 +26,18 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
+  dcache_init ();
   inode_init ();
   free_map_init ();
 
   if (format)
     do_format ();
+  else
+    log_recover ();
 
   free_map_open ();
+  orphan_open ();
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -35,9 +45,169 @@ filesys_init (bool format)
 void
 filesys_done (void)
 {
+  inode_done ();
+  orphan_close ();
   free_map_close ();
+  log_close ();
+  cache_flush ();
 }
 
+/* Extracts a file name part from *SRCP into PART, and updates
+   *SRCP so that the next call will return the next file name
+   part.  Returns 1 if successful, 0 at end of string, -1 for a
+   too-long file name part. */
+static int
+get_next_part (char part[NAME_MAX + 1], const char **srcp)
+{
+  const char *src = *srcp;
+  char *dst = part;
+
+  /* Skip leading slashes.  If it's all slashes, we're done. */
+  while (*src == '/')
+    src++;
+  if (*src == '\0')
+    return 0;
+
+  /* Copy up to NAME_MAX character from SRC to DST.  Add null
+     terminator. */
+  while (*src != '/' && *src != '\0')
+    {
+      if (dst < part + NAME_MAX)
+        *dst++ = *src;
+      else
+        return -1;
+      src++;
+    }
+  *dst = '\0';
+
+  /* Advance source pointer. */
+  *srcp = src;
+  return 1;
+}
+
+/* Resolves PATH, relative to the current thread's working
+   directory unless it starts with "/".  On success, returns true,
+   sets *DIRP to the directory that contains the last component
+   of PATH, which the caller must close, and copies that
+   component into NAME.  NAME is set to "" if PATH names a
+   directory with no last component, as "/" does, in which case
+   *DIRP is that directory itself.  Returns false if PATH is
+   empty, a component is too long, or a directory along the way
+   does not exist. */
+static bool
+resolve_path (const char *path, struct dir **dirp, char name[NAME_MAX + 1])
+{
+  struct thread *t = thread_current ();
+  struct dir *dir;
+  char part[NAME_MAX + 1];
+  int ok;
+
+  *dirp = NULL;
+  if (*path == '\0')
+    return false;
+
+  if (*path == '/' || t->cwd == NULL)
+    dir = dir_open_root ();
+  else
+    dir = dir_reopen (t->cwd);
+  if (dir == NULL)
+    return false;
+
+  /* Descend through every component but the last. */
+  ok = get_next_part (name, &path);
+  if (ok == 0)
+    *name = '\0';
+  while (ok > 0)
+    {
+      struct inode *inode;
+
+      ok = get_next_part (part, &path);
+      if (ok <= 0)
+        break;
+
+      if (!dir_lookup (dir, name, &inode) || !inode_is_dir (inode))
+        {
+          inode_close (inode);
+          ok = -1;
+          break;
+        }
+      dir_close (dir);
+      dir = dir_open (inode);
+      if (dir == NULL)
+        return false;
+      strlcpy (name, part, NAME_MAX + 1);
+    }
+
+  if (ok < 0)
+    {
+      dir_close (dir);
+      return false;
+    }
+  *dirp = dir;
+  return true;
+}
+
+/* Creates a file or, if IS_DIR, a directory named NAME with the
+   given INITIAL_SIZE.
+
+   The new inode is created empty and linked into its directory
+   in one log operation.  The file is then grown to INITIAL_SIZE
+   in further operations, each small enough for the log, so that
+   any size fits and a crash partway through leaves a shorter
+   file rather than leaked sectors.  If the disk fills up, the
+   file is removed again. */
+static bool
+create (const char *name, off_t initial_size, bool is_dir)
+{
+  block_sector_t inode_sector = 0;
+  struct dir *dir;
+  char base[NAME_MAX + 1];
+  bool success;
+
+  if (!resolve_path (name, &dir, base))
+    return false;
+  log_begin ();
+  success = *base != '\0' && free_map_allocate (1, &inode_sector);
+  if (success)
+    {
+      /* dir_create() releases INODE_SECTOR itself on failure. */
+      if (is_dir)
+        success = dir_create (inode_sector,
+                              inode_get_inumber (dir_get_inode (dir)));
+      else if (!inode_create (inode_sector, 0, false))
+        {
+          free_map_release (inode_sector, 1);
+          success = false;
+        }
+
+      /* Once the inode exists, it owns INODE_SECTOR and its data,
+         and removing it releases them all. */
+      if (success && !dir_add (dir, base, inode_sector))
+        {
+          struct inode *inode = inode_open (inode_sector);
+          if (inode != NULL)
+            {
+              inode_remove (inode);
+              inode_close (inode);
+            }
+          success = false;
+        }
+    }
+  log_end ();
+
+  if (success && !is_dir && initial_size > 0)
+    {
+      struct inode *inode = inode_open (inode_sector);
+      success = (inode != NULL
+                 && inode_allocate (inode, 0, initial_size));
+      inode_close (inode);
+      if (!success)
+        dir_remove (dir, base);
+    }
+  dir_close (dir);
+  return success;
+}
+
 /* Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
@@ -45,31 +215,40 @@ filesys_done (void)
 bool
 filesys_create (const char *name, off_t initial_size)
 {
-  block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
-  if (!success && inode_sector != 0)
-    free_map_release (inode_sector, 1);
-  dir_close (dir);
-  return success;
+  return create (name, initial_size, false);
+}
+
+/* Creates a directory named NAME.
+   Returns true if successful, false otherwise.
+   Fails if a file named NAME already exists, if a directory
+   leading to it does not, or if internal memory allocation
+   fails. */
+bool
+filesys_mkdir (const char *name)
+{
+  return create (name, 0, true);
 }
 
 /* Opens the file with the given NAME.
    Returns the new file if successful or a null pointer
    otherwise.
    Fails if no file named NAME exists,
-   or if an internal memory allocation fails. */
+   or if an internal memory allocation fails.
+   NAME may name a directory; use inode_is_dir() on the
+   file's inode to tell. */
 struct file *
 filesys_open (const char *name)
 {
-  struct dir *dir = dir_open_root ();
+  struct dir *dir;
   struct inode *inode = NULL;
+  char base[NAME_MAX + 1];
 
-  if (dir != NULL)
-    dir_lookup (dir, name, &inode);
+  if (!resolve_path (name, &dir, base))
+    return NULL;
+  if (*base == '\0')
+    inode = inode_reopen (dir_get_inode (dir));
+  else
+    dir_lookup (dir, base, &inode);
   dir_close (dir);
 
   return file_open (inode);
@@ -82,21 +261,60 @@ filesys_open (const char *name)
 bool
 filesys_remove (const char *name)
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  struct dir *dir;
+  char base[NAME_MAX + 1];
+  bool success;
+
+  if (!resolve_path (name, &dir, base))
+    return false;
+  success = *base != '\0' && dir_remove (dir, base);
   dir_close (dir);
 
   return success;
 }
-
+
+/* Changes the current thread's working directory to NAME.
+   Returns true if successful, false if NAME does not name a
+   directory. */
+bool
+filesys_chdir (const char *name)
+{
+  struct thread *t = thread_current ();
+  struct dir *dir;
+  struct inode *inode = NULL;
+  char base[NAME_MAX + 1];
+
+  if (!resolve_path (name, &dir, base))
+    return false;
+  if (*base == '\0')
+    inode = inode_reopen (dir_get_inode (dir));
+  else
+    dir_lookup (dir, base, &inode);
+  dir_close (dir);
+
+  if (inode == NULL || !inode_is_dir (inode))
+    {
+      inode_close (inode);
+      return false;
+    }
+  dir = dir_open (inode);
+  if (dir == NULL)
+    return false;
+  dir_close (t->cwd);
+  t->cwd = dir;
+  return true;
+}
+
 /* Formats the file system. */
 static void
 do_format (void)
 {
   printf ("Formatting file system...");
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  if (!dir_create (ROOT_DIR_SECTOR, ROOT_DIR_SECTOR))
     PANIC ("root directory creation failed");
+  orphan_create ();
   free_map_close ();
+  log_format ();
   printf ("done.\n");
 }
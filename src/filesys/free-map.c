@@ -1,22 +1,70 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <stdio.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/log.h"
+#include "threads/synch.h"
+
+/* Most sectors the file system uses.  Keeping sector numbers
+   below 2**31 means that sums such as a run's first sector plus
+   its length, which the allocator and the extent tree compute
+   freely, never overflow block_sector_t.  Only the first
+   FREE_MAP_SECTOR_MAX sectors of a larger device are used. */
+#define FREE_MAP_SECTOR_MAX ((block_sector_t) 1 << 31)
+
+/* Length of the free run free_map_allocate_run() looks for when
+   its goal sector is taken. */
+#define FREE_MAP_RUN 8
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static block_sector_t search_hint;   /* Where free_map_allocate() starts. */
+static size_t free_cnt;              /* Number of free sectors. */
+static size_t reserved_cnt;          /* Free sectors set aside by
+                                        free_map_reserve(). */
+
+/* Protects everything above.  Held while the changed part of the
+   free map is written back, which never allocates, because the
+   free map file is created at its full size. */
+static struct lock free_map_lock;
+
+/* Writes the CNT bits starting at SECTOR to the free map file,
+   leaving the rest of the file alone.  Returns true if
+   successful or if the free map file is not open. */
+static bool
+write_range (block_sector_t sector, size_t cnt)
+{
+  return (free_map_file == NULL
+          || bitmap_write_range (free_map, free_map_file, sector, cnt));
+}
 
 /* Initializes the free map. */
 void
 free_map_init (void)
 {
-  free_map = bitmap_create (block_size (fs_device));
+  block_sector_t size = block_size (fs_device);
+
+  lock_init (&free_map_lock);
+  if (size > FREE_MAP_SECTOR_MAX)
+    {
+      printf ("filesys: using only the first %"PRDSNu" of the %"PRDSNu
+              " sectors of %s\n", FREE_MAP_SECTOR_MAX, size,
+              block_name (fs_device));
+      size = FREE_MAP_SECTOR_MAX;
+    }
+  free_map = bitmap_create (size);
   if (free_map == NULL)
-    PANIC ("bitmap creation failed--file system device is too large");
+    PANIC ("no memory for the free map of a %"PRDSNu"-sector file system",
+           size);
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_mark (free_map, ORPHAN_SECTOR);
+  bitmap_set_multiple (free_map, LOG_SECTOR, LOG_SECTORS, true);
+  free_cnt = bitmap_count (free_map, 0, bitmap_size (free_map), false);
+  reserved_cnt = 0;
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -27,26 +75,159 @@ free_map_init (void)
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  block_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+
+  /* Search onward from where the last search ended, so that
+     allocated sectors at the start of the disk are not rescanned
+     every time, then wrap around.  Leave reserved sectors
+     alone. */
+  sector = BITMAP_ERROR;
+  if (free_cnt - reserved_cnt >= cnt)
+    {
+      sector = bitmap_scan_and_flip (free_map, search_hint, cnt, false);
+      if (sector == BITMAP_ERROR && search_hint != 0)
+        sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+    }
+  if (sector != BITMAP_ERROR && !write_range (sector, cnt))
     {
       bitmap_set_multiple (free_map, sector, cnt, false);
       sector = BITMAP_ERROR;
     }
   if (sector != BITMAP_ERROR)
-    *sectorp = sector;
+    {
+      free_cnt -= cnt;
+      *sectorp = sector;
+      search_hint = sector + cnt < bitmap_size (free_map) ? sector + cnt : 0;
+    }
+  lock_release (&free_map_lock);
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates one sector, preferably GOAL, and stores it into
+   *SECTORP, as free_map_allocate_run() would.
+   Returns true if successful, false if the disk is full or the
+   free_map file could not be written. */
+bool
+free_map_allocate_near (block_sector_t goal, block_sector_t *sectorp)
+{
+  size_t cnt;
+
+  return free_map_allocate_run (goal, 1, false, sectorp, &cnt);
+}
+
+/* Allocates a run of at most MAX_CNT consecutive sectors,
+   preferably starting at GOAL, and stores the first into
+   *SECTORP and the run's length into *CNTP.  If GOAL is taken,
+   the run starts at the first sector after GOAL that begins
+   FREE_MAP_RUN free sectors, or as many as MAX_CNT if fewer, so
+   that the caller has room to keep growing contiguously, and
+   failing that at any free sector at all.  The run may be
+   shorter than MAX_CNT if it reaches an allocated sector.
+
+   If RESERVED, the sectors are taken out of those the caller
+   set aside earlier with free_map_reserve(), and MAX_CNT must
+   not exceed them; otherwise reserved sectors are left alone.
+   Returns true if successful, false if the disk is full or the
+   free_map file could not be written. */
+bool
+free_map_allocate_run (block_sector_t goal, size_t max_cnt, bool reserved,
+                       block_sector_t *sectorp, size_t *cntp)
+{
+  size_t size = bitmap_size (free_map);
+  block_sector_t sector = BITMAP_ERROR;
+  size_t cnt;
+  bool success = false;
+
+  ASSERT (max_cnt > 0);
+  if (goal >= size)
+    goal = 0;
+
+  lock_acquire (&free_map_lock);
+  if (reserved)
+    {
+      ASSERT (max_cnt <= reserved_cnt);
+    }
+  else if (max_cnt > free_cnt - reserved_cnt)
+    max_cnt = free_cnt - reserved_cnt;
+
+  if (max_cnt > 0)
+    {
+      size_t run = max_cnt < FREE_MAP_RUN ? max_cnt : FREE_MAP_RUN;
+
+      if (!bitmap_test (free_map, goal))
+        sector = goal;
+      else
+        {
+          sector = bitmap_scan (free_map, goal, run, false);
+          if (sector == BITMAP_ERROR)
+            sector = bitmap_scan (free_map, 0, run, false);
+          if (sector == BITMAP_ERROR)
+            sector = bitmap_scan (free_map, 0, 1, false);
+        }
+    }
+
+  if (sector != BITMAP_ERROR)
+    {
+      for (cnt = 1; cnt < max_cnt && sector + cnt < size; cnt++)
+        if (bitmap_test (free_map, sector + cnt))
+          break;
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      if (write_range (sector, cnt))
+        {
+          free_cnt -= cnt;
+          if (reserved)
+            reserved_cnt -= cnt;
+          *sectorp = sector;
+          *cntp = cnt;
+          success = true;
+        }
+      else
+        bitmap_set_multiple (free_map, sector, cnt, false);
+    }
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Sets aside CNT free sectors, without choosing which, for a
+   later free_map_allocate_run() with RESERVED true.  Other
+   allocations will not use them.  Returns true if successful,
+   false if fewer than CNT unreserved sectors are free. */
+bool
+free_map_reserve (size_t cnt)
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = free_cnt - reserved_cnt >= cnt;
+  if (success)
+    reserved_cnt += cnt;
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Gives back CNT sectors set aside by free_map_reserve() that
+   will not be allocated after all. */
+void
+free_map_unreserve (size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (cnt <= reserved_cnt);
+  reserved_cnt -= cnt;
+  lock_release (&free_map_lock);
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  write_range (sector, cnt);
+  free_cnt += cnt;
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,13 +239,18 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  free_cnt = bitmap_count (free_map, 0, bitmap_size (free_map), false);
 }
 
-/* Writes the free map to disk and closes the free map file. */
+/* Writes the free map to disk and closes the free map file.
+   Later changes to the free map are made in memory only. */
 void
 free_map_close (void)
 {
+  lock_acquire (&free_map_lock);
   file_close (free_map_file);
+  free_map_file = NULL;
+  lock_release (&free_map_lock);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -73,7 +259,7 @@ void
 free_map_create (void)
 {
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
     PANIC ("free map creation failed");
 
   /* Write bitmap to file. */
@@ -12,6 +12,11 @@ void free_map_open (void);
 void free_map_close (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+bool free_map_allocate_near (block_sector_t goal, block_sector_t *);
+bool free_map_allocate_run (block_sector_t goal, size_t max_cnt,
+                            bool reserved, block_sector_t *, size_t *cnt);
+bool free_map_reserve (size_t);
+void free_map_unreserve (size_t);
 void free_map_release (block_sector_t, size_t);
 
 #endif /* filesys/free-map.h */
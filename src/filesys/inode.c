@@ -1,25 +1,114 @@
 #include "filesys/inode.h"
-#include <list.h>
 #include <debug.h>
+#include <hash.h>
+#include <list.h>
 #include <round.h>
+#include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/log.h"
+#include "filesys/orphan.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
-/* On-disk inode.
+/* Identifies an extent tree node. */
+#define EXTENT_MAGIC 0xf30a
+
+/* An extent: CNT data sectors of a file, starting at file sector
+   START, stored in consecutive device sectors starting at
+   SECTOR.  In an index node, an entry instead names in SECTOR
+   the child node that holds the file's extents from START on,
+   and CNT and FLAGS are unused. */
+struct extent
+  {
+    uint32_t start;                     /* First file sector. */
+    block_sector_t sector;              /* First device sector. */
+    uint16_t cnt;                       /* Number of sectors. */
+    uint16_t flags;                     /* EXTENT_* flags. */
+  };
+
+/* Extent flags. */
+#define EXTENT_UNWRITTEN 0x1            /* Allocated, never written. */
+
+/* Longest extent.  Keeps the free map bits of an extent within
+   two free map sectors, so that allocating or releasing one fits
+   in a single log operation. */
+#define EXTENT_MAX 2048
+
+/* Header of an extent tree node. */
+struct extent_header
+  {
+    uint16_t magic;                     /* EXTENT_MAGIC. */
+    uint16_t cnt;                       /* Number of entries in use. */
+    uint16_t depth;                     /* 0 for a leaf. */
+    uint16_t unused;                    /* Not used. */
+  };
+
+/* Number of entries in an extent tree node sector. */
+#define NODE_EXTENTS ((BLOCK_SECTOR_SIZE - sizeof (struct extent_header)) \
+                      / sizeof (struct extent))
+
+/* Extent tree node, other than the root.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct extent_node
+  {
+    struct extent_header hdr;           /* Header. */
+    struct extent e[NODE_EXTENTS];      /* Entries, sorted by START. */
+  };
+
+/* Number of entries in the root of an extent tree. */
+#define ROOT_EXTENTS 40
+
+/* On-disk inode.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   Data sectors are found through a B+-tree of extents rooted in
+   the inode.  A leaf holds extents sorted by file sector; an
+   index node holds, for each child, the first file sector the
+   child covers, so a lookup binary searches one node per level.
+   Up to ROOT_EXTENTS extents fit in the inode itself.  A file
+   sector that no extent covers is a hole, which reads as zeros.
+   An extent with EXTENT_UNWRITTEN set has been allocated but
+   never written; it too reads as zeros, and each of its sectors
+   is only zeroed on disk when first written, so preallocating
+   space costs no data writes.
+
+   A file of at most INLINE_MAX bytes instead keeps its data in
+   the space of the tree root, with INODE_INLINE set in FLAGS, so
+   that it needs no data sector at all.  It moves to data
+   sectors the first time it grows past INLINE_MAX. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    union
+      {
+        struct
+          {
+            struct extent_header hdr;   /* Header of extent tree root. */
+            struct extent root[ROOT_EXTENTS]; /* Root entries. */
+          };
+        uint8_t inline_data[sizeof (struct extent_header)
+                            + ROOT_EXTENTS * sizeof (struct extent)];
+      };
+    uint32_t flags;                     /* INODE_* flags. */
+    uint32_t unused[3];                 /* Not used. */
   };
 
+/* Largest file stored inline. */
+#define INLINE_MAX ((off_t) sizeof ((struct inode_disk *) 0)->inline_data)
+
+/* Inode flags. */
+#define INODE_DIR 0x1                   /* Inode is a directory. */
+#define INODE_INLINE 0x2                /* Data stored in inode. */
+
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
 static inline size_t
@@ -28,49 +117,937 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* A sector of a regular file that has been written but not yet
+   given a place on disk.  Its space is reserved in the free map
+   when it is first written, so that the write fails cleanly if
+   the disk is full, but the sector itself is only chosen at
+   write-back, together with its pending neighbours, so that a
+   file written a little at a time still gets long contiguous
+   extents. */
+struct pending_block
+  {
+    struct list_elem elem;              /* Element in inode's PENDING. */
+    uint32_t idx;                       /* File sector number. */
+    uint8_t *data;                      /* Sector contents. */
+  };
+
+/* Pending blocks an inode may hold before the writer that adds
+   one more writes them back itself. */
+#define PENDING_MAX 64
+
+/* Pending blocks all inodes together may hold before a writer
+   writes back its own. */
+#define PENDING_TOTAL_MAX 256
+
+/* Milliseconds between runs of the write-back thread. */
+#define INODE_WRITEBACK_MSECS 5000
+
+/* In-memory inode.
+
+   OPEN_CNT and LOADING are protected by open_inodes_lock.  RW protects
+   DENY_WRITE_CNT, DATA, PENDING and the file's tree nodes and
+   data sectors: readers, and writers that stay within sectors
+   already written, hold it for reading; writers that change the
+   extent tree or pending blocks, or extend the file, hold it for
+   writing.  DIR_LOCK is used by directory.c to serialise changes
+   to a directory's entries. */
 struct inode
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
+    bool loading;                       /* DATA still being read? */
     bool removed;                       /* True if deleted, false otherwise. */
+    off_t orphan_ofs;                   /* Orphan list entry, or -1. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct rwlock rw;                   /* Protects data and contents. */
+    struct rwlock dir_lock;             /* Protects directory entries. */
+    struct list pending;                /* Pending blocks, by file sector. */
+    size_t pending_cnt;                 /* Number of pending blocks. */
     struct inode_disk data;             /* Inode content. */
   };
 
-/* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+/* A sector's worth of zeros. */
+static char zeros[BLOCK_SECTOR_SIZE];
+
+/* Pending blocks held by all inodes together. */
+static size_t pending_total;
+static struct lock pending_lock;        /* Protects pending_total. */
+
+/* Returns true if the contents of the file described by DISK,
+   whose inode is in SECTOR, are file system metadata that must go
+   through the log: directories, the free map and the orphan
+   list. */
+static bool
+journaled (const struct inode_disk *disk, block_sector_t sector)
+{
+  return ((disk->flags & INODE_DIR) != 0
+          || sector == FREE_MAP_SECTOR || sector == ORPHAN_SECTOR);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR at byte offset OFS,
+   through the log if LOGGED. */
+static void
+write_sector (block_sector_t sector, const void *buffer, int ofs, int size,
+              bool logged)
+{
+  if (logged)
+    log_write (sector, buffer, ofs, size);
+  else
+    cache_write (sector, buffer, ofs, size);
+}
+
+/* Makes DISK's extent tree empty. */
+static void
+init_tree (struct inode_disk *disk)
+{
+  memset (disk->inline_data, 0, INLINE_MAX);
+  disk->hdr.magic = EXTENT_MAGIC;
+}
+
+/* Returns the byte offset of entry I within a tree node
+   sector. */
+static int
+entry_ofs (size_t i)
+{
+  return sizeof (struct extent_header) + i * sizeof (struct extent);
+}
+
+/* Reads entry I of the tree node in sector NODE into *EXT, or
+   entry I of DISK's tree root if NODE is 0.  (Sector 0 holds the
+   free map inode, so it is never a tree node.) */
+static void
+get_entry (const struct inode_disk *disk, block_sector_t node, size_t i,
+           struct extent *ext)
+{
+  if (node == 0)
+    *ext = disk->root[i];
+  else
+    cache_read (node, ext, entry_ofs (i), sizeof *ext);
+}
+
+/* Returns the index of the last of the CNT entries of NODE, as
+   for get_entry(), whose START is at most IDX, or 0 if there is
+   none.  CNT must be positive. */
+static size_t
+find_entry (const struct inode_disk *disk, block_sector_t node, size_t cnt,
+            uint32_t idx)
+{
+  size_t lo = 0, hi = cnt;
+
+  while (hi - lo > 1)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      struct extent ext;
+
+      get_entry (disk, node, mid, &ext);
+      if (ext.start <= idx)
+        lo = mid;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+/* Finds the leaf entry of DISK's extent tree that would cover
+   file sector IDX.  Stores the leaf into *NODEP (0 for the
+   root), the entry's index within it into *IP and the entry
+   itself into *EXT, and returns true, unless the tree is empty,
+   in which case returns false. */
+static bool
+find_leaf_entry (const struct inode_disk *disk, uint32_t idx,
+                 block_sector_t *nodep, size_t *ip, struct extent *ext)
+{
+  struct extent_header hdr = disk->hdr;
+  block_sector_t node = 0;
+
+  for (;;)
+    {
+      if (hdr.cnt == 0)
+        return false;
+      *ip = find_entry (disk, node, hdr.cnt, idx);
+      get_entry (disk, node, *ip, ext);
+      if (hdr.depth == 0)
+        break;
+      node = ext->sector;
+      cache_read (node, &hdr, 0, sizeof hdr);
+      ASSERT (hdr.magic == EXTENT_MAGIC);
+    }
+  *nodep = node;
+  return true;
+}
+
+/* Looks up file sector IDX in DISK's extent tree.  If an extent
+   covers it, stores that extent into *EXT and returns true;
+   otherwise IDX lies in a hole and returns false.  Takes time
+   logarithmic in the number of extents. */
+static bool
+extent_lookup (const struct inode_disk *disk, uint32_t idx,
+               struct extent *ext)
+{
+  block_sector_t node;
+  size_t i;
+
+  return (find_leaf_entry (disk, idx, &node, &i, ext)
+          && ext->start <= idx && idx - ext->start < ext->cnt);
+}
+
+/* Replaces the leaf entry of DISK's extent tree whose START is
+   START by EXT, which must cover only file sectors the old entry
+   covered.  A change to the root is made only in memory; the
+   caller must log DISK's write back to its inode sector in the
+   same operation. */
+static void
+extent_replace (struct inode_disk *disk, uint32_t start,
+                const struct extent *ext)
+{
+  struct extent old;
+  block_sector_t node;
+  size_t i;
+
+  if (!find_leaf_entry (disk, start, &node, &i, &old))
+    NOT_REACHED ();
+  ASSERT (old.start == start);
+  if (node == 0)
+    disk->root[i] = *ext;
+  else
+    log_write (node, ext, entry_ofs (i), sizeof *ext);
+}
+
+/* Most new tree nodes that one log operation may need. */
+#define POOL_MAX 12
+
+/* Sectors set aside for new tree nodes before an insertion into
+   an extent tree starts, so that the insertion cannot fail
+   halfway through for lack of disk space. */
+struct node_pool
+  {
+    block_sector_t sectors[POOL_MAX];   /* Allocated sectors. */
+    size_t cnt;                         /* Number of sectors. */
+  };
+
+/* Allocates into POOL enough sectors for INSERTS insertions of
+   extents that start near file sector IDX into DISK's tree,
+   whose inode is in INODE_SECTOR.  Nodes are only allocated if
+   some node on the way to IDX is close enough to full to split.
+   Returns true if successful, false if the disk is full. */
+static bool
+pool_fill (struct node_pool *pool, const struct inode_disk *disk,
+           block_sector_t inode_sector, uint32_t idx, size_t inserts)
+{
+  struct extent_header hdr = disk->hdr;
+  block_sector_t node = 0;
+  size_t need = 0;
+
+  pool->cnt = 0;
+  for (;;)
+    {
+      size_t max = node == 0 ? ROOT_EXTENTS : NODE_EXTENTS;
+      struct extent ext;
+
+      if (hdr.cnt + inserts > max)
+        need = inserts * (disk->hdr.depth + 2);
+      if (hdr.depth == 0 || hdr.cnt == 0)
+        break;
+      get_entry (disk, node, find_entry (disk, node, hdr.cnt, idx), &ext);
+      node = ext.sector;
+      cache_read (node, &hdr, 0, sizeof hdr);
+    }
+
+  ASSERT (need <= POOL_MAX);
+  while (pool->cnt < need)
+    {
+      if (!free_map_allocate_near (inode_sector + 1,
+                                   &pool->sectors[pool->cnt]))
+        {
+          while (pool->cnt > 0)
+            free_map_release (pool->sectors[--pool->cnt], 1);
+          return false;
+        }
+      pool->cnt++;
+    }
+  return true;
+}
+
+/* Releases the sectors left over in POOL. */
+static void
+pool_drain (struct node_pool *pool)
+{
+  while (pool->cnt > 0)
+    free_map_release (pool->sectors[--pool->cnt], 1);
+}
+
+/* A tree node being changed: the root, in the inode, or a copy
+   of another node. */
+struct node_ref
+  {
+    block_sector_t sector;              /* Node's sector, or 0 for root. */
+    struct extent_header *hdr;          /* Node's header. */
+    struct extent *e;                   /* Node's entries. */
+    size_t max;                         /* Capacity of E. */
+    struct extent_node *copy;           /* Copy of non-root node. */
+  };
+
+/* Sets up N to refer to DISK's tree root. */
+static void
+ref_root (struct node_ref *n, struct inode_disk *disk)
+{
+  n->sector = 0;
+  n->hdr = &disk->hdr;
+  n->e = disk->root;
+  n->max = ROOT_EXTENTS;
+  n->copy = NULL;
+}
+
+/* Sets up N to refer to a copy of the tree node in SECTOR, read
+   from disk if READ is true, otherwise empty. */
+static void
+ref_node (struct node_ref *n, block_sector_t sector, bool read)
+{
+  ASSERT (sizeof *n->copy == BLOCK_SECTOR_SIZE);
+
+  n->copy = malloc (sizeof *n->copy);
+  if (n->copy == NULL)
+    PANIC ("out of memory changing extent tree");
+  if (read)
+    cache_read (sector, n->copy, 0, BLOCK_SECTOR_SIZE);
+  else
+    {
+      memset (n->copy, 0, sizeof *n->copy);
+      n->copy->hdr.magic = EXTENT_MAGIC;
+    }
+  n->sector = sector;
+  n->hdr = &n->copy->hdr;
+  n->e = n->copy->e;
+  n->max = NODE_EXTENTS;
+}
+
+/* Logs the new contents of N, unless it is the root, and frees
+   its copy. */
+static void
+ref_done (struct node_ref *n)
+{
+  if (n->copy != NULL)
+    {
+      log_write (n->sector, n->copy, 0, BLOCK_SECTOR_SIZE);
+      free (n->copy);
+    }
+}
+
+/* Returns true if extent B directly follows extent A, both in
+   the file and on disk, and the two can become one. */
+static bool
+mergeable (const struct extent *a, const struct extent *b)
+{
+  return (a->start + a->cnt == b->start
+          && a->sector + a->cnt == b->sector
+          && a->flags == b->flags
+          && a->cnt + b->cnt <= EXTENT_MAX);
+}
+
+/* Inserts ENTRY into node N at position POS.  If N is full,
+   first splits it, moving its upper half into a new node from
+   POOL, and stores into *SPLIT the index entry for the new node;
+   otherwise sets SPLIT->sector to 0.  N must not be the root if
+   it is full. */
+static void
+insert_entry (struct node_ref *n, size_t pos, const struct extent *entry,
+              struct node_pool *pool, struct extent *split)
+{
+  struct node_ref right, *target = n;
+  size_t cnt = n->hdr->cnt;
+
+  split->sector = 0;
+  if (cnt == n->max)
+    {
+      size_t half = cnt / 2;
+
+      ASSERT (n->sector != 0 && pool->cnt > 0);
+      ref_node (&right, pool->sectors[--pool->cnt], false);
+      right.hdr->depth = n->hdr->depth;
+      right.hdr->cnt = cnt - half;
+      memcpy (right.e, n->e + half, (cnt - half) * sizeof *n->e);
+      n->hdr->cnt = half;
+      if (pos > half)
+        {
+          target = &right;
+          pos -= half;
+        }
+    }
+
+  memmove (target->e + pos + 1, target->e + pos,
+           (target->hdr->cnt - pos) * sizeof *target->e);
+  target->e[pos] = *entry;
+  target->hdr->cnt++;
+
+  if (cnt == n->max)
+    {
+      split->start = right.e[0].start;
+      split->sector = right.sector;
+      split->cnt = split->flags = 0;
+      ref_done (&right);
+    }
+}
+
+/* Inserts EXT into the subtree rooted at node N, taking any new
+   nodes it needs from POOL, and sets *SPLIT as insert_entry()
+   does if N had to be split.  Merges EXT into a neighbouring
+   extent in the same leaf instead where possible. */
+static void
+insert_into (struct node_ref *n, const struct extent *ext,
+             struct node_pool *pool, struct extent *split)
+{
+  size_t cnt = n->hdr->cnt;
+  size_t pos;
+
+  /* Find the first entry that starts after EXT. */
+  for (pos = cnt; pos > 0 && n->e[pos - 1].start > ext->start; pos--)
+    continue;
+
+  split->sector = 0;
+  if (n->hdr->depth == 0)
+    {
+      ASSERT (pos == 0
+              || n->e[pos - 1].start + n->e[pos - 1].cnt <= ext->start);
+      ASSERT (pos == cnt || ext->start + ext->cnt <= n->e[pos].start);
+      if (pos > 0 && mergeable (&n->e[pos - 1], ext))
+        n->e[pos - 1].cnt += ext->cnt;
+      else if (pos < cnt && mergeable (ext, &n->e[pos]))
+        {
+          n->e[pos].start = ext->start;
+          n->e[pos].sector = ext->sector;
+          n->e[pos].cnt += ext->cnt;
+        }
+      else
+        insert_entry (n, pos, ext, pool, split);
+    }
+  else
+    {
+      size_t i = pos > 0 ? pos - 1 : 0;
+      struct node_ref child;
+      struct extent child_split;
+
+      ref_node (&child, n->e[i].sector, true);
+      ASSERT (child.hdr->magic == EXTENT_MAGIC);
+      insert_into (&child, ext, pool, &child_split);
+      ref_done (&child);
+      if (child_split.sector != 0)
+        insert_entry (n, i + 1, &child_split, pool, split);
+    }
+}
+
+/* Inserts EXT, which must not overlap any extent already there,
+   into DISK's extent tree, taking new nodes from POOL, which
+   pool_fill() must have filled for the insertion.  The tree
+   grows a level when its root is full.  Changes to the root are
+   made only in memory; the caller must log DISK's write back to
+   its inode sector in the same operation. */
+static void
+extent_insert (struct inode_disk *disk, struct node_pool *pool,
+               const struct extent *ext)
+{
+  struct node_ref root;
+  struct extent split;
+
+  if (disk->hdr.cnt == ROOT_EXTENTS)
+    {
+      /* Move the root's entries into a new node below it. */
+      struct node_ref child;
+
+      ASSERT (pool->cnt > 0);
+      ref_node (&child, pool->sectors[--pool->cnt], false);
+      *child.hdr = disk->hdr;
+      memcpy (child.e, disk->root, sizeof disk->root);
+      disk->hdr.depth++;
+      disk->hdr.cnt = 1;
+      disk->root[0].start = 0;
+      disk->root[0].sector = child.sector;
+      disk->root[0].cnt = disk->root[0].flags = 0;
+      ref_done (&child);
+    }
+
+  ref_root (&root, disk);
+  insert_into (&root, ext, pool, &split);
+  ASSERT (split.sector == 0);
+}
+
+/* Returns the sector that file sector IDX of the file described
+   by DISK, whose inode is in INODE_SECTOR, should ideally
+   occupy: the one just after file sector IDX - 1, or just after
+   the inode if that has no sector.  Allocating at these goals
+   lays out sequentially written files as long contiguous runs,
+   which the extent tree records compactly and multi-sector
+   transfers and read-ahead can then cover. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos)
+allocation_goal (const struct inode_disk *disk, block_sector_t inode_sector,
+                 uint32_t idx)
 {
-  ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+  struct extent ext;
+
+  if (idx > 0 && extent_lookup (disk, idx - 1, &ext))
+    return ext.sector + (idx - ext.start);
+  return inode_sector + 1;
+}
+
+/* Allocates sectors for the CNT file sectors of the file
+   described by DISK, whose inode is in INODE_SECTOR, starting at
+   file sector IDX, none of which may be covered by an extent or
+   pending, and records them as extents with the given FLAGS.
+   With EXTENT_UNWRITTEN, the sectors read as zeros without ever
+   being written.  Each run of sectors is allocated in a log
+   operation of its own, which also logs DISK's write back to
+   INODE_SECTOR.  Returns true if successful, false if the disk
+   fills up; sectors allocated before a failure stay
+   allocated. */
+static bool
+allocate_extents (struct inode_disk *disk, block_sector_t inode_sector,
+                  uint32_t idx, size_t cnt, uint16_t flags)
+{
+  while (cnt > 0)
+    {
+      block_sector_t goal = allocation_goal (disk, inode_sector, idx);
+      struct node_pool pool;
+      struct extent ext;
+      size_t got = 0;
+      bool success;
+
+      log_begin ();
+      success = pool_fill (&pool, disk, inode_sector, idx, 1);
+      if (success)
+        {
+          success = free_map_allocate_run (goal, (cnt < EXTENT_MAX
+                                                  ? cnt : EXTENT_MAX),
+                                           false, &ext.sector, &got);
+          if (success)
+            {
+              ext.start = idx;
+              ext.cnt = got;
+              ext.flags = flags;
+              extent_insert (disk, &pool, &ext);
+              log_write (inode_sector, disk, 0, BLOCK_SECTOR_SIZE);
+            }
+          pool_drain (&pool);
+        }
+      log_end ();
+      if (!success)
+        return false;
+
+      idx += got;
+      cnt -= got;
+    }
+  return true;
+}
+
+/* Allocates a zeroed sector for file sector IDX of INODE, a
+   journaled() file in which IDX lies in a hole, in a log
+   operation of its own.  Returns the new sector, or 0 if the
+   disk is full. */
+static block_sector_t
+allocate_journaled (struct inode *inode, uint32_t idx)
+{
+  struct inode_disk *disk = &inode->data;
+  struct node_pool pool;
+  struct extent ext;
+  block_sector_t sector = 0;
+
+  log_begin ();
+  if (pool_fill (&pool, disk, inode->sector, idx, 1))
+    {
+      if (free_map_allocate_near (allocation_goal (disk, inode->sector, idx),
+                                  &sector))
+        {
+          log_write (sector, zeros, 0, BLOCK_SECTOR_SIZE);
+          ext.start = idx;
+          ext.sector = sector;
+          ext.cnt = 1;
+          ext.flags = 0;
+          extent_insert (disk, &pool, &ext);
+          log_write (inode->sector, disk, 0, BLOCK_SECTOR_SIZE);
+        }
+      else
+        sector = 0;
+      pool_drain (&pool);
+    }
+  log_end ();
+  return sector;
+}
+
+/* Records file sector IDX of INODE, which lies in unwritten
+   extent EXT, as written, in a log operation of its own.  This
+   splits EXT, but sequential writes into preallocated space
+   only move the boundary between its written and unwritten
+   parts.  Returns true if successful, false if the disk is too
+   full for the extent tree to grow. */
+static bool
+mark_written (struct inode *inode, const struct extent *ext, uint32_t idx)
+{
+  struct inode_disk *disk = &inode->data;
+  uint32_t ofs = idx - ext->start;
+  struct extent before = *ext, written, after = *ext;
+  struct node_pool pool;
+
+  log_begin ();
+  if (!pool_fill (&pool, disk, inode->sector, idx, 2))
+    {
+      log_end ();
+      return false;
+    }
+
+  written.start = idx;
+  written.sector = ext->sector + ofs;
+  written.cnt = 1;
+  written.flags = 0;
+  if (ext->cnt == 1)
+    extent_replace (disk, ext->start, &written);
+  else if (ofs == 0)
+    {
+      after.start++;
+      after.sector++;
+      after.cnt--;
+      extent_replace (disk, ext->start, &after);
+      extent_insert (disk, &pool, &written);
+    }
   else
-    return -1;
+    {
+      before.cnt = ofs;
+      extent_replace (disk, ext->start, &before);
+      extent_insert (disk, &pool, &written);
+      if (ofs + 1 < ext->cnt)
+        {
+          after.start = idx + 1;
+          after.sector = written.sector + 1;
+          after.cnt = ext->cnt - ofs - 1;
+          extent_insert (disk, &pool, &after);
+        }
+    }
+  pool_drain (&pool);
+  log_write (inode->sector, disk, 0, BLOCK_SECTOR_SIZE);
+  log_end ();
+  return true;
+}
+
+/* Removes the last leaf entry of the subtree rooted at node N
+   and releases its sectors, along with any node that this leaves
+   empty.  N must not be empty. */
+static void
+pop_last (struct node_ref *n)
+{
+  struct extent *last = &n->e[n->hdr->cnt - 1];
+
+  ASSERT (n->hdr->cnt > 0);
+  if (n->hdr->depth == 0)
+    free_map_release (last->sector, last->cnt);
+  else
+    {
+      struct node_ref child;
+
+      ref_node (&child, last->sector, true);
+      ASSERT (child.hdr->magic == EXTENT_MAGIC);
+      pop_last (&child);
+      if (child.hdr->cnt > 0)
+        {
+          ref_done (&child);
+          return;
+        }
+      free_map_release (child.sector, 1);
+      free (child.copy);
+    }
+  n->hdr->cnt--;
+}
+
+/* Releases every data sector and tree node of the file
+   described by DISK, whose inode is in INODE_SECTOR.  The tree
+   shrinks from its end one extent per log operation, each of
+   which also logs DISK's write back, so that releasing a large
+   file cannot overflow the log and the tree on disk never names
+   a released sector. */
+static void
+release_sectors (struct inode_disk *disk, block_sector_t inode_sector)
+{
+  if (disk->flags & INODE_INLINE)
+    return;
+  while (disk->hdr.cnt > 0)
+    {
+      struct node_ref root;
+
+      log_begin ();
+      ref_root (&root, disk);
+      pop_last (&root);
+      log_write (inode_sector, disk, 0, BLOCK_SECTOR_SIZE);
+      log_end ();
+    }
+}
+
+/* Returns INODE's pending block for file sector IDX, or a null
+   pointer if there is none. */
+static struct pending_block *
+find_pending (const struct inode *inode, uint32_t idx)
+{
+  struct list_elem *e;
+
+  for (e = list_begin ((struct list *) &inode->pending);
+       e != list_end ((struct list *) &inode->pending); e = list_next (e))
+    {
+      struct pending_block *pb = list_entry (e, struct pending_block, elem);
+      if (pb->idx >= idx)
+        return pb->idx == idx ? pb : NULL;
+    }
+  return NULL;
+}
+
+/* Adds a zeroed pending block for file sector IDX, which must lie
+   in a hole, to INODE, reserving a sector for it.  Returns the
+   new block, or a null pointer if the disk is full or memory is
+   short. */
+static struct pending_block *
+add_pending (struct inode *inode, uint32_t idx)
+{
+  struct pending_block *pb;
+  struct list_elem *e;
+
+  if (!free_map_reserve (1))
+    return NULL;
+  pb = malloc (sizeof *pb);
+  if (pb != NULL)
+    pb->data = calloc (1, BLOCK_SECTOR_SIZE);
+  if (pb == NULL || pb->data == NULL)
+    {
+      free (pb);
+      free_map_unreserve (1);
+      return NULL;
+    }
+  pb->idx = idx;
+
+  for (e = list_rbegin (&inode->pending); e != list_rend (&inode->pending);
+       e = list_prev (e))
+    if (list_entry (e, struct pending_block, elem)->idx < idx)
+      break;
+  list_insert (list_next (e), &pb->elem);
+  inode->pending_cnt++;
+
+  lock_acquire (&pending_lock);
+  pending_total++;
+  lock_release (&pending_lock);
+  return pb;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Frees the first CNT of INODE's pending blocks.  If RESERVED,
+   they still have sectors reserved, which are given back. */
+static void
+drop_pending (struct inode *inode, size_t cnt, bool reserved)
+{
+  size_t i;
+
+  ASSERT (cnt <= inode->pending_cnt);
+  for (i = 0; i < cnt; i++)
+    {
+      struct pending_block *pb = list_entry (list_pop_front (&inode->pending),
+                                             struct pending_block, elem);
+      free (pb->data);
+      free (pb);
+    }
+  inode->pending_cnt -= cnt;
+  if (reserved)
+    free_map_unreserve (cnt);
+
+  lock_acquire (&pending_lock);
+  pending_total -= cnt;
+  lock_release (&pending_lock);
+}
 
-/* Initializes the inode module. */
+/* Writes back INODE's pending blocks, lowest first.  Each run of
+   consecutive blocks gets sectors as contiguous as the free map
+   allows, placed after the file's preceding sector, and becomes
+   one extent, or extends the preceding one, in a log operation
+   of its own.  The data goes through the buffer cache, which
+   writes it to disk before the log commits the extent.  The
+   caller must hold INODE's lock for writing.  Returns true if
+   successful, false if the disk is too full for the extent tree
+   to grow, in which case the remaining blocks stay pending. */
+static bool
+writeback (struct inode *inode)
+{
+  struct inode_disk *disk = &inode->data;
+
+  while (inode->pending_cnt > 0)
+    {
+      struct pending_block *first;
+      struct list_elem *e;
+      struct node_pool pool;
+      struct extent ext;
+      size_t run, got, i;
+
+      first = list_entry (list_front (&inode->pending),
+                          struct pending_block, elem);
+      for (run = 1, e = list_next (&first->elem);
+           e != list_end (&inode->pending) && run < EXTENT_MAX;
+           run++, e = list_next (e))
+        if (list_entry (e, struct pending_block, elem)->idx
+            != first->idx + run)
+          break;
+
+      log_begin ();
+      if (!pool_fill (&pool, disk, inode->sector, first->idx, 1))
+        {
+          log_end ();
+          return false;
+        }
+      if (!free_map_allocate_run (allocation_goal (disk, inode->sector,
+                                                   first->idx),
+                                  run, true, &ext.sector, &got))
+        PANIC ("reserved sectors not available");
+      for (i = 0, e = &first->elem; i < got; i++, e = list_next (e))
+        cache_write (ext.sector + i,
+                     list_entry (e, struct pending_block, elem)->data,
+                     0, BLOCK_SECTOR_SIZE);
+      ext.start = first->idx;
+      ext.cnt = got;
+      ext.flags = 0;
+      extent_insert (disk, &pool, &ext);
+      pool_drain (&pool);
+      log_write (inode->sector, disk, 0, BLOCK_SECTOR_SIZE);
+      log_end ();
+
+      drop_pending (inode, got, false);
+    }
+  return true;
+}
+
+/* Open inodes, keyed on sector, so that opening a single inode
+   twice returns the same `struct inode'. */
+static struct hash open_inodes;
+
+/* Protects open_inodes and the open_cnt and loading of every
+   open inode. */
+static struct lock open_inodes_lock;
+
+/* Signaled when an open inode finishes loading. */
+static struct condition inode_loaded;
+
+/* Serialises runs of writeback_all(), so that inode_done() can
+   stop the write-back thread between runs. */
+static struct lock writeback_lock;
+static bool writeback_stopped;          /* Set by inode_done(). */
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
+static void writeback_all (void);
+static thread_func writeback_daemon NO_RETURN;
+
+/* Initializes the inode module and starts the write-back
+   thread. */
 void
 inode_init (void)
 {
-  list_init (&open_inodes);
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
+  lock_init (&open_inodes_lock);
+  cond_init (&inode_loaded);
+  lock_init (&pending_lock);
+  pending_total = 0;
+  lock_init (&writeback_lock);
+  writeback_stopped = false;
+  thread_create ("inode-writeback", PRI_DEFAULT, writeback_daemon, NULL);
+}
+
+/* Returns a hash value for the inode that contains E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+/* Returns true if inode A's sector precedes inode B's. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
+
+/* Writes back every pending block at shutdown and stops the
+   write-back thread, waiting for a run in progress to finish,
+   so that nothing writes to the file system behind the caller's
+   back while it closes the free map and the log. */
+void
+inode_done (void)
+{
+  lock_acquire (&writeback_lock);
+  writeback_all ();
+  writeback_stopped = true;
+  lock_release (&writeback_lock);
+}
+
+/* Writes back the pending blocks of every open inode that has
+   not been removed.  Stops early if the disk is too full for an
+   inode's extent tree to grow.  The caller must hold
+   writeback_lock. */
+static void
+writeback_all (void)
+{
+  for (;;)
+    {
+      struct inode *inode = NULL;
+      struct hash_iterator i;
+      bool success;
+
+      /* Pick an inode with pending blocks and keep it open while
+         writing them back. */
+      lock_acquire (&open_inodes_lock);
+      hash_first (&i, &open_inodes);
+      while (hash_next (&i))
+        {
+          struct inode *candidate = hash_entry (hash_cur (&i),
+                                                struct inode, elem);
+          if (candidate->pending_cnt > 0 && !candidate->removed)
+            {
+              inode = candidate;
+              inode->open_cnt++;
+              break;
+            }
+        }
+      lock_release (&open_inodes_lock);
+      if (inode == NULL)
+        break;
+
+      rwlock_acquire_write (&inode->rw);
+      success = writeback (inode);
+      rwlock_release_write (&inode->rw);
+      inode_close (inode);
+      if (!success)
+        break;
+    }
+}
+
+/* Write-back thread.  Periodically writes back pending blocks,
+   so that written data does not sit in memory indefinitely
+   without a place on disk. */
+static void
+writeback_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_msleep (INODE_WRITEBACK_MSECS);
+      lock_acquire (&writeback_lock);
+      if (writeback_stopped)
+        {
+          lock_release (&writeback_lock);
+          thread_exit ();
+        }
+      writeback_all ();
+      lock_release (&writeback_lock);
+    }
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The inode is a directory if IS_DIR is true, otherwise
+   an ordinary file, stored inline if LENGTH permits.  Data
+   sectors are preallocated as unwritten extents.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, bool is_dir)
 {
   struct inode_disk *disk_inode = NULL;
   bool success = false;
@@ -84,22 +1061,30 @@ inode_create (block_sector_t sector, off_t length)
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start))
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0)
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
+      disk_inode->flags = is_dir ? INODE_DIR : 0;
+      if (!is_dir && length <= INLINE_MAX)
+        disk_inode->flags |= INODE_INLINE;
+      else
+        init_tree (disk_inode);
 
-              for (i = 0; i < sectors; i++)
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
+      /* The free map is written in full as soon as it is
+         created, and its first write must not have to change its
+         extent tree, which might allocate sectors from the free
+         map itself, so it gets written extents from the
+         start. */
+      if ((disk_inode->flags & INODE_INLINE)
+          || allocate_extents (disk_inode, sector, 0,
+                               bytes_to_sectors (length),
+                               (sector != FREE_MAP_SECTOR
+                                ? EXTENT_UNWRITTEN : 0)))
+        {
+          log_write (sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
           success = true;
         }
+      else
+        release_sectors (disk_inode, sector);
       free (disk_inode);
     }
   return success;
@@ -111,33 +1096,55 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e))
+  lock_acquire (&open_inodes_lock);
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector)
-        {
-          inode_reopen (inode);
-          return inode;
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      while (inode->loading)
+        cond_wait (&inode_loaded, &open_inodes_lock);
+      lock_release (&open_inodes_lock);
+      return inode;
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize, and publish the inode marked as loading, so that
+     the lock need not be held while the disk inode is read.
+     Anyone else who opens it meanwhile waits above until it is
+     loaded. */
   inode->sector = sector;
   inode->open_cnt = 1;
+  inode->loading = true;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->orphan_ofs = -1;
+  rwlock_init (&inode->rw);
+  rwlock_init (&inode->dir_lock);
+  list_init (&inode->pending);
+  inode->pending_cnt = 0;
+  hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+
+  cache_read (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+
+  lock_acquire (&open_inodes_lock);
+  inode->loading = false;
+  cond_broadcast (&inode_loaded, &open_inodes_lock);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -146,7 +1153,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -157,28 +1168,73 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
+/* Returns true if INODE is a directory, false if it is an
+   ordinary file. */
+bool
+inode_is_dir (const struct inode *inode)
+{
+  return (inode->data.flags & INODE_DIR) != 0;
+}
+
+/* Returns the number of openers INODE currently has. */
+int
+inode_open_cnt (const struct inode *inode)
+{
+  return inode->open_cnt;
+}
+
 /* Closes INODE and writes it to disk.
    If this was the last reference to INODE, frees its memory.
    If INODE was also a removed inode, frees its blocks. */
 void
 inode_close (struct inode *inode)
 {
+  bool last, full = false;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
+  /* The last opener writes back pending blocks, unless INODE is
+     going away, before giving up its reference.  Until then
+     INODE stays in open_inodes, so anyone who opens it meanwhile
+     shares it rather than reading the stale inode from disk. */
+  lock_acquire (&open_inodes_lock);
+  while (inode->open_cnt == 1 && inode->pending_cnt > 0
+         && !inode->removed && !full)
+    {
+      lock_release (&open_inodes_lock);
+      rwlock_acquire_write (&inode->rw);
+      full = !writeback (inode);
+      rwlock_release_write (&inode->rw);
+      lock_acquire (&open_inodes_lock);
+    }
+
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  last = --inode->open_cnt == 0;
+  if (last)
+    hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+      if (inode->pending_cnt > 0)
+        {
+          if (!inode->removed)
+            printf ("inode %"PRDSNu": disk full, %zu sectors lost\n",
+                    inode->sector, inode->pending_cnt);
+          drop_pending (inode, inode->pending_cnt, true);
+        }
 
-      /* Deallocate blocks if removed. */
+      /* Deallocate blocks if removed.  The inode sector goes
+         last, together with the orphan list entry. */
       if (inode->removed)
         {
+          release_sectors (&inode->data, inode->sector);
+          log_begin ();
+          orphan_clear (inode->orphan_ofs);
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length));
+          log_end ();
         }
 
       free (inode);
@@ -186,12 +1242,47 @@ inode_close (struct inode *inode)
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
-   has it open. */
+   has it open, and puts it on the orphan list until then.  Must
+   be called in the log operation that erases INODE's directory
+   entry, if it has one.  Does nothing if INODE is already
+   removed. */
 void
 inode_remove (struct inode *inode)
 {
   ASSERT (inode != NULL);
+  if (inode->removed)
+    return;
   inode->removed = true;
+  inode->orphan_ofs = orphan_add (inode->sector);
+}
+
+/* Returns true if INODE has been removed. */
+bool
+inode_is_removed (const struct inode *inode)
+{
+  return inode->removed;
+}
+
+/* Acquires INODE's directory lock, for writing if EXCLUSIVE,
+   otherwise for reading. */
+void
+inode_lock_dir (struct inode *inode, bool exclusive)
+{
+  if (exclusive)
+    rwlock_acquire_write (&inode->dir_lock);
+  else
+    rwlock_acquire_read (&inode->dir_lock);
+}
+
+/* Releases INODE's directory lock, which must have been acquired
+   with the same EXCLUSIVE. */
+void
+inode_unlock_dir (struct inode *inode, bool exclusive)
+{
+  if (exclusive)
+    rwlock_release_write (&inode->dir_lock);
+  else
+    rwlock_release_read (&inode->dir_lock);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -202,13 +1293,28 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  struct extent ext;
+  bool have_ext = false;
 
+  rwlock_acquire_read (&inode->rw);
+  if (inode->data.flags & INODE_INLINE)
+    {
+      /* Serve the read from the in-memory inode. */
+      if (offset < inode->data.length)
+        {
+          bytes_read = inode->data.length - offset;
+          if (bytes_read > size)
+            bytes_read = size;
+          memcpy (buffer, inode->data.inline_data + offset, bytes_read);
+        }
+      size = 0;
+    }
   while (size > 0)
     {
-      /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      /* File sector to read, starting byte offset within sector. */
+      uint32_t sector_no = offset / BLOCK_SECTOR_SIZE;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      struct pending_block *pb;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
       off_t inode_left = inode_length (inode) - offset;
@@ -220,91 +1326,236 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
+      /* A sequential read stays within one extent for many
+         sectors, so look up another only on leaving it. */
+      pb = find_pending (inode, sector_no);
+      if (pb == NULL && (!have_ext || sector_no < ext.start
+                         || sector_no - ext.start >= ext.cnt))
+        have_ext = extent_lookup (&inode->data, sector_no, &ext);
+
+      if (pb != NULL)
+        memcpy (buffer + bytes_read, pb->data + sector_ofs, chunk_size);
+      else if (have_ext && !(ext.flags & EXTENT_UNWRITTEN))
+        cache_read (ext.sector + (sector_no - ext.start),
+                    buffer + bytes_read, sector_ofs, chunk_size);
       else
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL)
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+        memset (buffer + bytes_read, 0, chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  rwlock_release_read (&inode->rw);
 
   return bytes_read;
 }
 
+/* Asks the buffer cache to fetch, in the background, the sectors
+   that hold bytes OFFSET through OFFSET + SIZE - 1 of INODE.
+   Bytes past end of file or not yet on disk are ignored. */
+void
+inode_readahead (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+  struct extent ext;
+  bool have_ext = false;
+
+  rwlock_acquire_read (&inode->rw);
+  if (end > inode->data.length)
+    end = inode->data.length;
+  if (inode->data.flags & INODE_INLINE)
+    end = 0;
+  for (offset -= offset % BLOCK_SECTOR_SIZE; offset < end;
+       offset += BLOCK_SECTOR_SIZE)
+    {
+      uint32_t sector_no = offset / BLOCK_SECTOR_SIZE;
+
+      if (!have_ext || sector_no < ext.start
+          || sector_no - ext.start >= ext.cnt)
+        have_ext = extent_lookup (&inode->data, sector_no, &ext);
+      if (have_ext && !(ext.flags & EXTENT_UNWRITTEN))
+        cache_readahead (ext.sector + (sector_no - ext.start));
+    }
+  rwlock_release_read (&inode->rw);
+}
+
+/* Moves the data of INODE, which is stored inline, out of the
+   inode, so that INODE can grow past INLINE_MAX.  The data
+   becomes a pending block, or for a journaled() file goes
+   straight to a new data sector.  The caller must hold INODE's
+   lock for writing.  Returns true if successful, false if out of
+   memory or disk space. */
+static bool
+move_inline_data (struct inode *inode)
+{
+  struct inode_disk *disk = &inode->data;
+  uint8_t *data = malloc (INLINE_MAX);
+  bool success = true;
+
+  if (data == NULL)
+    return false;
+  memcpy (data, disk->inline_data, INLINE_MAX);
+
+  log_begin ();
+  disk->flags &= ~INODE_INLINE;
+  init_tree (disk);
+  if (disk->length > 0)
+    {
+      if (journaled (disk, inode->sector))
+        {
+          block_sector_t sector = allocate_journaled (inode, 0);
+          if (sector != 0)
+            log_write (sector, data, 0, disk->length);
+          else
+            success = false;
+        }
+      else
+        {
+          struct pending_block *pb = add_pending (inode, 0);
+          if (pb != NULL)
+            memcpy (pb->data, data, disk->length);
+          else
+            success = false;
+        }
+    }
+  if (success)
+    log_write (inode->sector, disk, 0, BLOCK_SECTOR_SIZE);
+  else
+    {
+      /* Put everything back. */
+      disk->flags |= INODE_INLINE;
+      memcpy (disk->inline_data, data, INLINE_MAX);
+    }
+  log_end ();
+
+  free (data);
+  return success;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or an error occurs.
+   Writing past end of file extends INODE; any gap left between
+   the old end of file and OFFSET becomes a hole.
+
+   Data written into a hole of a regular file is held in pending
+   blocks and only given sectors when it is written back: once
+   the inode holds more than PENDING_MAX of them or all inodes
+   more than PENDING_TOTAL_MAX, at last close, by the write-back
+   thread and at shutdown.  Directory and free map sectors are
+   allocated as they are written, because the log needs their
+   home sectors. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset)
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  bool logged = journaled (&inode->data, inode->sector);
+  bool exclusive;
+
+  /* Writes that extend the file or change inline data need
+     exclusive access from the start.  Others share access with
+     readers until they reach a sector that is not on disk yet.
+     A file never goes back to being inline, so checking
+     INODE_INLINE unlocked is safe. */
+  exclusive = (offset + size > inode->data.length
+               || (inode->data.flags & INODE_INLINE) != 0);
+  if (exclusive)
+    rwlock_acquire_write (&inode->rw);
+  else
+    rwlock_acquire_read (&inode->rw);
 
   if (inode->deny_write_cnt)
-    return 0;
+    size = 0;
+
+  if (size > 0 && (inode->data.flags & INODE_INLINE))
+    {
+      if (offset + size <= INLINE_MAX)
+        {
+          /* Write into the inode itself. */
+          memcpy (inode->data.inline_data + offset, buffer, size);
+          if (offset + size > inode->data.length)
+            inode->data.length = offset + size;
+          log_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+          bytes_written = size;
+          size = 0;
+        }
+      else if (!move_inline_data (inode))
+        size = 0;
+    }
 
   while (size > 0)
     {
-      /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      /* File sector to write, starting byte offset within sector. */
+      uint32_t sector_no = offset / BLOCK_SECTOR_SIZE;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      struct pending_block *pb;
+      struct extent ext;
+      bool found = false;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      /* Bytes left in sector. */
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
 
       /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
+      int chunk_size = size < sector_left ? size : sector_left;
+
+      pb = find_pending (inode, sector_no);
+      if (pb == NULL)
+        found = extent_lookup (&inode->data, sector_no, &ext);
+
+      if ((pb != NULL || !found || (ext.flags & EXTENT_UNWRITTEN))
+          && !exclusive)
+        {
+          /* Pending blocks, holes and unwritten sectors may only
+             be changed with exclusive access, so start over
+             with it.  Someone else may have changed this sector
+             meanwhile, so look it up again. */
+          rwlock_release_read (&inode->rw);
+          rwlock_acquire_write (&inode->rw);
+          exclusive = true;
+          if (inode->deny_write_cnt)
+            break;
+          continue;
+        }
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (pb == NULL && !found && !logged)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          pb = add_pending (inode, sector_no);
+          if (pb == NULL)
+            break;
         }
+
+      if (pb != NULL)
+        memcpy (pb->data + sector_ofs, buffer + bytes_written, chunk_size);
       else
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL)
+          block_sector_t sector;
+
+          if (!found)
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
+              sector = allocate_journaled (inode, sector_no);
+              if (sector == 0)
                 break;
             }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left)
-            block_read (fs_device, sector_idx, bounce);
           else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+            {
+              sector = ext.sector + (sector_no - ext.start);
+              if (ext.flags & EXTENT_UNWRITTEN)
+                {
+                  /* First write to a preallocated sector.  Zero
+                     the rest of it now, in the cache, and record
+                     it as written. */
+                  if (chunk_size < BLOCK_SECTOR_SIZE)
+                    write_sector (sector, zeros, 0, BLOCK_SECTOR_SIZE,
+                                  logged);
+                  if (!mark_written (inode, &ext, sector_no))
+                    break;
+                }
+            }
+          write_sector (sector, buffer + bytes_written, sector_ofs,
+                        chunk_size, logged);
         }
 
       /* Advance. */
@@ -312,18 +1563,105 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  /* Extend the file only after its new data is in place, so that
+     readers never see the new length before the data. */
+  if (bytes_written > 0 && offset > inode->data.length)
+    {
+      inode->data.length = offset;
+      log_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+    }
+
+  /* Keep the memory held in pending blocks bounded. */
+  if (exclusive && inode->pending_cnt > 0)
+    {
+      bool too_many;
+
+      lock_acquire (&pending_lock);
+      too_many = pending_total > PENDING_TOTAL_MAX;
+      lock_release (&pending_lock);
+      if (too_many || inode->pending_cnt > PENDING_MAX)
+        writeback (inode);
+    }
+
+  if (exclusive)
+    rwlock_release_write (&inode->rw);
+  else
+    rwlock_release_read (&inode->rw);
 
   return bytes_written;
 }
 
+/* Preallocates sectors for bytes OFFSET through OFFSET + SIZE - 1
+   of INODE, placed contiguously where possible, and extends
+   INODE to OFFSET + SIZE bytes if it is shorter.  The new
+   sectors are recorded as unwritten extents, so they cost no
+   data writes and read as zeros.  Returns true if successful,
+   false if the disk fills up or writes to INODE are denied.
+   Sectors allocated before a failure stay allocated. */
+bool
+inode_allocate (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+  bool success = true;
+
+  if (offset < 0 || size < 0 || end < offset)
+    return false;
+
+  rwlock_acquire_write (&inode->rw);
+  if (inode->deny_write_cnt)
+    success = false;
+  else if ((inode->data.flags & INODE_INLINE) && end > INLINE_MAX)
+    success = move_inline_data (inode);
+
+  /* Pending blocks lie in holes that are about to be
+     preallocated, so give them their sectors first. */
+  if (success)
+    success = writeback (inode);
+
+  if (success && !(inode->data.flags & INODE_INLINE))
+    {
+      uint32_t idx = offset / BLOCK_SECTOR_SIZE;
+      uint32_t end_idx = bytes_to_sectors (end);
+
+      while (success && idx < end_idx)
+        {
+          struct extent ext;
+          size_t cnt;
+
+          if (extent_lookup (&inode->data, idx, &ext))
+            {
+              idx = ext.start + ext.cnt;
+              continue;
+            }
+          for (cnt = 1; idx + cnt < end_idx && cnt < EXTENT_MAX; cnt++)
+            if (extent_lookup (&inode->data, idx + cnt, &ext))
+              break;
+          success = allocate_extents (&inode->data, inode->sector,
+                                      idx, cnt, EXTENT_UNWRITTEN);
+          idx += cnt;
+        }
+    }
+
+  if (success && end > inode->data.length)
+    {
+      inode->data.length = end;
+      log_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+    }
+  rwlock_release_write (&inode->rw);
+
+  return success;
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
 inode_deny_write (struct inode *inode)
 {
+  rwlock_acquire_write (&inode->rw);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rw);
 }
 
 /* Re-enables writes to INODE.
@@ -332,12 +1670,16 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode)
 {
+  rwlock_acquire_write (&inode->rw);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rw);
 }
 
-/* Returns the length, in bytes, of INODE's data. */
+/* Returns the length, in bytes, of INODE's data.  The length is
+   read without locking, so it may already be out of date if
+   another thread is extending INODE. */
 off_t
 inode_length (const struct inode *inode)
 {
@@ -0,0 +1,323 @@
+#include "filesys/log.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Write-ahead log of file system metadata.
+
+   Every change to metadata -- inodes, index blocks, directories
+   and the free map -- is made inside an operation bracketed by
+   log_begin() and log_end() and written with log_write().  The
+   new contents stay in the buffer cache, which holds them back
+   from the disk.  Committing writes them to the log region,
+   then a header naming their home sectors, which is the commit
+   point, and only then to their home sectors.  After a crash,
+   log_recover() copies the sectors of a committed transaction
+   home again, so each operation reaches the disk entirely or not
+   at all and the disk never needs to be scanned for repair.
+
+   Operations are committed in groups: log_end() leaves the
+   transaction open for later operations to join, and it is
+   committed once it has no room for another operation, every
+   LOG_COMMIT_MSECS by the commit thread, or by log_flush().  A
+   sector written many times in one group is logged once.
+
+   Before a transaction is committed, the buffer cache writes
+   back all other dirty sectors, so that file data reaches the
+   disk before the metadata that points to it. */
+
+/* Milliseconds between commits by the commit thread. */
+#define LOG_COMMIT_MSECS 5000
+
+/* Identifies a log header. */
+#define LOG_MAGIC 0x4c4f4721
+
+/* On-disk log header, in sector LOG_SECTOR.  A nonzero CNT marks
+   a committed transaction whose sectors have not all been
+   written home. */
+struct log_header
+  {
+    uint32_t magic;                     /* LOG_MAGIC. */
+    uint32_t cnt;                       /* Number of logged sectors. */
+    block_sector_t sectors[LOG_SIZE];   /* Home of each logged sector. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 8 - 4 * LOG_SIZE];
+  };
+
+bool log_crash;
+
+static bool log_enabled;                /* Has the log been opened? */
+static bool log_closing;                /* In log_close()? */
+static struct lock log_lock;            /* Protects the members below. */
+static struct condition log_changed;    /* Signaled on state changes. */
+static int outstanding;                 /* Operations in progress. */
+static bool committing;                 /* Commit in progress? */
+static bool commit_wanted;              /* log_flush() waiting? */
+static size_t log_cnt;                  /* Sectors in transaction. */
+static block_sector_t log_sectors[LOG_SIZE];   /* Their homes. */
+
+static thread_func commit_daemon NO_RETURN;
+static void open_log (void);
+
+/* Writes HEADER to the log header sector. */
+static void
+write_header (const struct log_header *header)
+{
+  ASSERT (sizeof *header == BLOCK_SECTOR_SIZE);
+  block_write (fs_device, LOG_SECTOR, header);
+}
+
+/* Initializes an empty log on a newly formatted file system,
+   writing back everything the formatting put in the cache, and
+   starts logging. */
+void
+log_format (void)
+{
+  struct log_header *header = calloc (1, sizeof *header);
+  if (header == NULL)
+    PANIC ("out of memory formatting log");
+  header->magic = LOG_MAGIC;
+  cache_flush ();
+  write_header (header);
+  free (header);
+  open_log ();
+}
+
+/* Completes any transaction committed to the log but not yet
+   written home when the file system was last shut down, then
+   starts logging.  Must be called before anything is read
+   through the buffer cache. */
+void
+log_recover (void)
+{
+  struct log_header *header = malloc (sizeof *header);
+  uint8_t *buffer = malloc (LOG_SIZE * BLOCK_SECTOR_SIZE);
+  size_t i;
+
+  if (header == NULL || buffer == NULL)
+    PANIC ("out of memory recovering log");
+
+  block_read (fs_device, LOG_SECTOR, header);
+  if (header->magic != LOG_MAGIC || header->cnt > LOG_SIZE)
+    PANIC ("file system has no log; reformat it");
+  if (header->cnt > 0)
+    {
+      printf ("filesys: replaying %u logged sectors\n", header->cnt);
+      block_read_multiple (fs_device, LOG_SECTOR + 1, header->cnt, buffer);
+      for (i = 0; i < header->cnt; i++)
+        block_write (fs_device, header->sectors[i],
+                     buffer + i * BLOCK_SECTOR_SIZE);
+      header->cnt = 0;
+      write_header (header);
+    }
+
+  free (buffer);
+  free (header);
+  open_log ();
+}
+
+/* Starts logging and the commit thread. */
+static void
+open_log (void)
+{
+  lock_init (&log_lock);
+  cond_init (&log_changed);
+  outstanding = 0;
+  committing = commit_wanted = false;
+  log_cnt = 0;
+  log_enabled = true;
+  thread_create ("log-commit", PRI_DEFAULT, commit_daemon, NULL);
+}
+
+/* Writes the current transaction to the log, commits it and
+   writes its sectors home.  The caller must have set COMMITTING
+   and must not hold log_lock; nobody else touches the
+   transaction meanwhile. */
+static void
+commit (void)
+{
+  struct log_header *header;
+  uint8_t *buffer;
+  size_t i;
+
+  if (log_cnt == 0)
+    return;
+
+  header = calloc (1, sizeof *header);
+  buffer = malloc (log_cnt * BLOCK_SECTOR_SIZE);
+  if (header == NULL || buffer == NULL)
+    PANIC ("out of memory committing log");
+
+  /* The log area is contiguous, so the whole transaction goes to
+     disk in one request. */
+  cache_flush ();
+  for (i = 0; i < log_cnt; i++)
+    cache_read (log_sectors[i], buffer + i * BLOCK_SECTOR_SIZE,
+                0, BLOCK_SECTOR_SIZE);
+  block_write_multiple (fs_device, LOG_SECTOR + 1, log_cnt, buffer);
+
+  /* Commit point. */
+  header->magic = LOG_MAGIC;
+  header->cnt = log_cnt;
+  memcpy (header->sectors, log_sectors, log_cnt * sizeof *log_sectors);
+  write_header (header);
+
+  if (log_closing && log_crash)
+    printf ("filesys: leaving %zu logged sectors to replay\n", log_cnt);
+  else
+    {
+      for (i = 0; i < log_cnt; i++)
+        cache_install (log_sectors[i]);
+      header->cnt = 0;
+      write_header (header);
+    }
+  log_cnt = 0;
+
+  free (buffer);
+  free (header);
+}
+
+/* Commits the current transaction, if it has any sectors.  The
+   caller must hold log_lock, and no operation may be in
+   progress. */
+static void
+commit_locked (void)
+{
+  ASSERT (outstanding == 0);
+
+  committing = true;
+  lock_release (&log_lock);
+  commit ();
+  lock_acquire (&log_lock);
+  committing = commit_wanted = false;
+  cond_broadcast (&log_changed, &log_lock);
+}
+
+/* Starts an operation that will change file system metadata.
+   Waits until the current transaction has room for the
+   operation's LOG_OP_MAX sectors.  Operations may nest; only the
+   outermost log_begin() and log_end() count. */
+void
+log_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  if (!log_enabled || t->log_depth++ > 0)
+    return;
+
+  lock_acquire (&log_lock);
+  while (committing || commit_wanted
+         || log_cnt + (outstanding + 1) * LOG_OP_MAX > LOG_SIZE)
+    cond_wait (&log_changed, &log_lock);
+  outstanding++;
+  lock_release (&log_lock);
+}
+
+/* Ends an operation started with log_begin().  Commits the
+   transaction if the operation was the last one in progress and
+   either the log is too full for another or log_flush() is
+   waiting. */
+void
+log_end (void)
+{
+  struct thread *t = thread_current ();
+
+  if (!log_enabled)
+    return;
+  ASSERT (t->log_depth > 0);
+  if (--t->log_depth > 0)
+    return;
+
+  lock_acquire (&log_lock);
+  outstanding--;
+  if (outstanding == 0
+      && (commit_wanted || log_cnt + LOG_OP_MAX > LOG_SIZE))
+    commit_locked ();
+  else
+    cond_broadcast (&log_changed, &log_lock);
+  lock_release (&log_lock);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR at byte offset OFS,
+   as part of the current operation.  Starts and ends an
+   operation of its own if none is in progress. */
+void
+log_write (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  size_t i;
+
+  if (!log_enabled)
+    {
+      cache_write (sector, buffer, ofs, size);
+      return;
+    }
+
+  log_begin ();
+  lock_acquire (&log_lock);
+  for (i = 0; i < log_cnt; i++)
+    if (log_sectors[i] == sector)
+      break;
+  if (i == log_cnt)
+    {
+      if (log_cnt >= LOG_SIZE)
+        PANIC ("log transaction too big");
+      log_sectors[log_cnt++] = sector;
+    }
+  lock_release (&log_lock);
+  cache_write_logged (sector, buffer, ofs, size);
+  log_end ();
+}
+
+/* Commits the current transaction, waiting for operations in
+   progress to finish first.  New operations wait until the
+   commit is done. */
+void
+log_flush (void)
+{
+  if (!log_enabled)
+    return;
+
+  lock_acquire (&log_lock);
+  while (committing)
+    cond_wait (&log_changed, &log_lock);
+  if (outstanding == 0)
+    commit_locked ();
+  else
+    {
+      commit_wanted = true;
+      while (commit_wanted)
+        cond_wait (&log_changed, &log_lock);
+    }
+  lock_release (&log_lock);
+}
+
+/* Commits the current transaction at shutdown and stops the
+   commit thread.  With log_crash, the commit stops at its commit
+   point, leaving its sectors unwritten at home, and the buffer
+   cache holds them back from any later cache_flush(). */
+void
+log_close (void)
+{
+  log_closing = true;
+  log_flush ();
+}
+
+/* Commit thread.  Periodically commits the current transaction,
+   so that completed operations do not wait indefinitely to
+   become durable. */
+static void
+commit_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_msleep (LOG_COMMIT_MSECS);
+      if (log_closing)
+        thread_exit ();
+      log_flush ();
+    }
+}
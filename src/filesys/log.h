@@ -0,0 +1,30 @@
+#ifndef FILESYS_LOG_H
+#define FILESYS_LOG_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Number of sectors in the log region, starting at LOG_SECTOR:
+   one header sector followed by LOG_SIZE sectors of logged
+   data. */
+#define LOG_SIZE 40
+#define LOG_SECTORS (LOG_SIZE + 1)
+
+/* Most sectors a single operation may log. */
+#define LOG_OP_MAX 16
+
+void log_format (void);
+void log_recover (void);
+void log_begin (void);
+void log_end (void);
+void log_write (block_sector_t, const void *buffer, int ofs, int size);
+void log_flush (void);
+void log_close (void);
+
+/* If true, log_close() stops committing the final transaction at
+   its commit point, as if power failed there, so that the next
+   boot has to replay it.  Used to test recovery.  Controlled by
+   kernel command-line option "-logcrash". */
+extern bool log_crash;
+
+#endif /* filesys/log.h */
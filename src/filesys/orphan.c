@@ -0,0 +1,122 @@
+#include "filesys/orphan.h"
+#include <debug.h>
+#include <stdio.h>
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "filesys/log.h"
+#include "threads/synch.h"
+
+/* Orphan list.
+
+   A removed inode keeps its sectors until its last opener closes
+   it, and releasing a large file takes many log operations, so
+   for a while an inode can be allocated without any directory
+   entry naming it.  The orphan list records the inode sector of
+   each such inode, so that a crash in that window does not leak
+   its sectors: orphan_open() releases whatever the list still
+   names at the next boot.
+
+   An inode goes on the list in the same log operation that
+   erases its last directory entry, and comes off it in the same
+   operation that releases its inode sector.  The list is a
+   journaled file of block_sector_t entries, in which 0 (the free
+   map's inode sector, which is never removed) marks a free
+   slot. */
+
+static struct inode *orphan_inode;      /* Orphan list file. */
+static struct lock orphan_lock;         /* Serialises changes to it. */
+
+/* Creates an empty orphan list on a newly formatted file
+   system. */
+void
+orphan_create (void)
+{
+  if (!inode_create (ORPHAN_SECTOR, 0, false))
+    PANIC ("orphan list creation failed");
+}
+
+/* Opens the orphan list and releases every inode left on it by a
+   crash. */
+void
+orphan_open (void)
+{
+  block_sector_t sector;
+  size_t cnt = 0;
+  off_t ofs;
+
+  lock_init (&orphan_lock);
+  orphan_inode = inode_open (ORPHAN_SECTOR);
+  if (orphan_inode == NULL)
+    PANIC ("can't open orphan list");
+
+  for (ofs = 0; inode_read_at (orphan_inode, &sector, sizeof sector, ofs)
+                == sizeof sector; ofs += sizeof sector)
+    if (sector != 0)
+      {
+        struct inode *inode = inode_open (sector);
+        if (inode == NULL)
+          PANIC ("can't open orphaned inode %"PRDSNu, sector);
+
+        /* Put it back on the list as a removed inode, so that
+           closing it releases it. */
+        log_begin ();
+        orphan_clear (ofs);
+        inode_remove (inode);
+        log_end ();
+        inode_close (inode);
+        cnt++;
+      }
+  if (cnt > 0)
+    printf ("filesys: released %zu orphaned inodes\n", cnt);
+}
+
+/* Closes the orphan list. */
+void
+orphan_close (void)
+{
+  inode_close (orphan_inode);
+  orphan_inode = NULL;
+}
+
+/* Adds inode SECTOR to the orphan list, as part of the current
+   log operation.  Returns the offset of its entry, to pass to
+   orphan_clear() later, or -1 if the list is not open or could
+   not grow, in which case a crash before SECTOR is released
+   leaks its sectors. */
+off_t
+orphan_add (block_sector_t sector)
+{
+  block_sector_t entry;
+  off_t ofs;
+
+  ASSERT (sector != 0);
+  if (orphan_inode == NULL)
+    return -1;
+
+  lock_acquire (&orphan_lock);
+  for (ofs = 0; inode_read_at (orphan_inode, &entry, sizeof entry, ofs)
+                == sizeof entry; ofs += sizeof entry)
+    if (entry == 0)
+      break;
+  if (inode_write_at (orphan_inode, &sector, sizeof sector, ofs)
+      != sizeof sector)
+    ofs = -1;
+  lock_release (&orphan_lock);
+  return ofs;
+}
+
+/* Frees the orphan list entry at OFS, as returned by
+   orphan_add(), as part of the current log operation.  Does
+   nothing if OFS is -1. */
+void
+orphan_clear (off_t ofs)
+{
+  block_sector_t entry = 0;
+
+  if (ofs < 0 || orphan_inode == NULL)
+    return;
+
+  lock_acquire (&orphan_lock);
+  inode_write_at (orphan_inode, &entry, sizeof entry, ofs);
+  lock_release (&orphan_lock);
+}
@@ -0,0 +1,14 @@
+#ifndef FILESYS_ORPHAN_H
+#define FILESYS_ORPHAN_H
+
+#include "filesys/off_t.h"
+#include "devices/block.h"
+
+void orphan_create (void);
+void orphan_open (void);
+void orphan_close (void);
+
+off_t orphan_add (block_sector_t);
+void orphan_clear (off_t);
+
+#endif /* filesys/orphan.h */
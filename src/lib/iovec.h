@@ -0,0 +1,17 @@
+#ifndef __LIB_IOVEC_H
+#define __LIB_IOVEC_H
+
+#include <stddef.h>
+
+/* One buffer of a readv() or writev() system call.  The layout
+   is shared between the kernel and user programs. */
+struct iovec
+  {
+    void *iov_base;             /* Start of buffer. */
+    size_t iov_len;             /* Length of buffer in bytes. */
+  };
+
+/* Most buffers accepted by one readv() or writev(). */
+#define IOV_MAX 64
+
+#endif /* lib/iovec.h */
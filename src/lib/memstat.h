@@ -0,0 +1,19 @@
+#ifndef __LIB_MEMSTAT_H
+#define __LIB_MEMSTAT_H
+
+/* Per-process paging statistics.  The kernel keeps one of these
+   in each user process and copies it out through the memstat
+   system call, so the layout is shared with user programs.
+
+   There are no fault, copy-on-write, eviction or swap counts,
+   because this kernel does not resolve page faults, share pages
+   or swap.  Code that adds those should add its counters here
+   too. */
+struct memstat
+  {
+    unsigned resident;          /* User pages mapped at last sample. */
+    unsigned ws_pages;          /* Pages accessed in last sample period. */
+    unsigned ws_peak;           /* Largest ws_pages seen so far. */
+  };
+
+#endif /* lib/memstat.h */
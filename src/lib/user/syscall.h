@@ -3,6 +3,8 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <iovec.h>
+#include <memstat.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -45,4 +47,13 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Local extensions. */
+bool memstat (struct memstat *);
+bool fallocate (int fd, unsigned offset, unsigned length);
+int pread (int fd, void *buffer, unsigned length, unsigned offset);
+int pwrite (int fd, const void *buffer, unsigned length, unsigned offset);
+int readv (int fd, const struct iovec *, int iovcnt);
+int writev (int fd, const struct iovec *, int iovcnt);
+int copy_file_range (int fd_in, int fd_out, unsigned length);
+
 #endif /* lib/user/syscall.h */
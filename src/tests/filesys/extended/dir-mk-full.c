@@ -0,0 +1,62 @@
+/* Fills the file system, then frees space two sectors at a time
+   and tries to create a directory after each step, so that some
+   of the attempts run out of space partway through.  Then
+   removes everything and verifies that a directory can still be
+   created. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SMALL_CNT 4
+
+static char buf[512];
+
+void
+test_main (void)
+{
+  bool made[SMALL_CNT];
+  char name[16];
+  int fd, i;
+
+  msg ("filling file system...");
+  quiet = true;
+  for (i = 0; i < SMALL_CNT; i++)
+    {
+      snprintf (name, sizeof name, "s%d", i);
+      CHECK (create (name, 0), "create \"%s\"", name);
+      CHECK ((fd = open (name)) > 1, "open \"%s\"", name);
+      CHECK (write (fd, buf, sizeof buf) == sizeof buf, "write \"%s\"", name);
+      close (fd);
+    }
+  CHECK (create ("fill", 0), "create \"fill\"");
+  CHECK ((fd = open ("fill")) > 1, "open \"fill\"");
+  while (write (fd, buf, sizeof buf) == sizeof buf)
+    continue;
+  close (fd);
+  quiet = false;
+
+  msg ("creating directories while freeing space...");
+  for (i = 0; i < SMALL_CNT; i++)
+    {
+      snprintf (name, sizeof name, "s%d", i);
+      CHECK (remove (name), "remove \"%s\"", name);
+      snprintf (name, sizeof name, "d%d", i);
+      made[i] = mkdir (name);
+    }
+
+  msg ("removing everything...");
+  quiet = true;
+  CHECK (remove ("fill"), "remove \"fill\"");
+  for (i = 0; i < SMALL_CNT; i++)
+    if (made[i])
+      {
+        snprintf (name, sizeof name, "d%d", i);
+        CHECK (remove (name), "remove \"%s\"", name);
+      }
+  quiet = false;
+
+  CHECK (mkdir ("a"), "mkdir \"a\"");
+  CHECK (remove ("a"), "remove \"a\"");
+}
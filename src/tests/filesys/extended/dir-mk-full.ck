@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-mk-full) begin
+(dir-mk-full) filling file system...
+(dir-mk-full) creating directories while freeing space...
+(dir-mk-full) remove "s0"
+(dir-mk-full) remove "s1"
+(dir-mk-full) remove "s2"
+(dir-mk-full) remove "s3"
+(dir-mk-full) removing everything...
+(dir-mk-full) mkdir "a"
+(dir-mk-full) remove "a"
+(dir-mk-full) end
+EOF
+pass;
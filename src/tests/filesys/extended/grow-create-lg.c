@@ -0,0 +1,40 @@
+/* Creates a file several megabytes long, larger than a single
+   log operation could allocate at once, and checks that it reads
+   back as zeros. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define TEST_SIZE 4000000
+
+static char buf[512];
+
+static void
+check_zeros (int fd, unsigned ofs)
+{
+  size_t i;
+
+  seek (fd, ofs);
+  if (read (fd, buf, sizeof buf) != sizeof buf)
+    fail ("read %zu bytes at offset %u failed", sizeof buf, ofs);
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != 0)
+      fail ("byte %u is %d, not 0", ofs + i, buf[i]);
+}
+
+void
+test_main (void)
+{
+  int fd;
+
+  CHECK (create ("big", TEST_SIZE), "create \"big\"");
+  CHECK ((fd = open ("big")) > 1, "open \"big\"");
+  CHECK (filesize (fd) == TEST_SIZE, "filesize \"big\" is %d", TEST_SIZE);
+  msg ("check that \"big\" reads as zeros");
+  check_zeros (fd, 0);
+  check_zeros (fd, TEST_SIZE / 2);
+  check_zeros (fd, TEST_SIZE - sizeof buf);
+  close (fd);
+  CHECK (remove ("big"), "remove \"big\"");
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-create-lg) begin
+(grow-create-lg) create "big"
+(grow-create-lg) open "big"
+(grow-create-lg) filesize "big" is 4000000
+(grow-create-lg) check that "big" reads as zeros
+(grow-create-lg) remove "big"
+(grow-create-lg) end
+EOF
+pass;
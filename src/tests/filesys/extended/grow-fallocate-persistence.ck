@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({"f" => ["abcdefghij" . "\0" x 9990 . "XYZ" . "\0" x 9997]});
+pass;
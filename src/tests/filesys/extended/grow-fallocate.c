@@ -0,0 +1,53 @@
+/* Preallocates space for a small file with fallocate(), checks
+   that the new space reads as zeros, then writes into the middle
+   of it and checks that the rest of that sector still reads as
+   zeros. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 20000
+#define MID_OFS 10000
+
+static char buf[FILE_SIZE];
+
+static void
+check_range (int fd, unsigned ofs, unsigned size, const char *expected)
+{
+  unsigned i;
+
+  seek (fd, ofs);
+  if (read (fd, buf, size) != (int) size)
+    fail ("read %u bytes at offset %u failed", size, ofs);
+  for (i = 0; i < size; i++)
+    if (buf[i] != (expected != NULL ? expected[i] : 0))
+      fail ("byte %u is %d, expected %d",
+            ofs + i, buf[i], expected != NULL ? expected[i] : 0);
+}
+
+void
+test_main (void)
+{
+  int fd;
+
+  CHECK (create ("f", 0), "create \"f\"");
+  CHECK ((fd = open ("f")) > 1, "open \"f\"");
+  CHECK (write (fd, "abcdefghij", 10) == 10, "write \"f\"");
+  CHECK (fallocate (fd, 0, FILE_SIZE), "fallocate \"f\"");
+  CHECK (filesize (fd) == FILE_SIZE, "filesize \"f\" is %d", FILE_SIZE);
+
+  msg ("check that preallocated space reads as zeros");
+  check_range (fd, 0, 10, "abcdefghij");
+  check_range (fd, 10, FILE_SIZE - 10, NULL);
+
+  seek (fd, MID_OFS);
+  CHECK (write (fd, "XYZ", 3) == 3, "write \"f\" at offset %d", MID_OFS);
+  msg ("check that the rest of the written sector reads as zeros");
+  check_range (fd, MID_OFS - 512, 512, NULL);
+  check_range (fd, MID_OFS, 3, "XYZ");
+  check_range (fd, MID_OFS + 3, 512, NULL);
+  msg ("close \"f\"");
+  close (fd);
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-fallocate) begin
+(grow-fallocate) create "f"
+(grow-fallocate) open "f"
+(grow-fallocate) write "f"
+(grow-fallocate) fallocate "f"
+(grow-fallocate) filesize "f" is 20000
+(grow-fallocate) check that preallocated space reads as zeros
+(grow-fallocate) write "f" at offset 10000
+(grow-fallocate) check that the rest of the written sector reads as zeros
+(grow-fallocate) close "f"
+(grow-fallocate) end
+EOF
+pass;
@@ -0,0 +1,37 @@
+/* Grows a file that is small enough to be stored in its inode
+   with a write that starts inside the inline data area and ends
+   past it, then keeps growing it, and checks its size at each
+   step. */
+
+#include <syscall.h>
+#include "tests/filesys/seq-test.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[1600];
+
+static size_t
+return_block_size (void)
+{
+  static const size_t sizes[] = {300, 300, 1000};
+  static size_t i;
+
+  return sizes[i++ % (sizeof sizes / sizeof *sizes)];
+}
+
+static void
+check_file_size (int fd, long ofs)
+{
+  long size = filesize (fd);
+  if (size != ofs)
+    fail ("filesize not updated properly: should be %ld, actually %ld",
+          ofs, size);
+}
+
+void
+test_main (void)
+{
+  seq_test ("testfile",
+            buf, sizeof buf, 0,
+            return_block_size, check_file_size);
+}
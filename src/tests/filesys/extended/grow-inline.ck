@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-inline) begin
+(grow-inline) create "testfile"
+(grow-inline) open "testfile"
+(grow-inline) writing "testfile"
+(grow-inline) close "testfile"
+(grow-inline) open "testfile" for verification
+(grow-inline) verified contents of "testfile"
+(grow-inline) close "testfile"
+(grow-inline) end
+EOF
+pass;
@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+fail "log was not replayed at boot\n"
+  if !grep (/^filesys: replaying \d+ logged sectors$/, @output);
+check_archive ({'a' => {'b' => ['b' x 1024]}, 'c' => ["\0" x 100]});
+pass;
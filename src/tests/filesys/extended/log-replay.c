@@ -0,0 +1,26 @@
+/* Creates a directory and files just before shutdown.  The test
+   runs with -logcrash, which leaves the last log transaction
+   committed but not written home, so the persistence check also
+   verifies that the next boot replays the log. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[1024];
+
+void
+test_main (void)
+{
+  int fd;
+
+  memset (buf, 'b', sizeof buf);
+  CHECK (mkdir ("a"), "mkdir \"a\"");
+  CHECK (create ("a/b", 0), "create \"a/b\"");
+  CHECK ((fd = open ("a/b")) > 1, "open \"a/b\"");
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf, "write \"a/b\"");
+  msg ("close \"a/b\"");
+  close (fd);
+  CHECK (create ("c", 100), "create \"c\"");
+}
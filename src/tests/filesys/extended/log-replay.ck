@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(log-replay) begin
+(log-replay) mkdir "a"
+(log-replay) create "a/b"
+(log-replay) open "a/b"
+(log-replay) write "a/b"
+(log-replay) close "a/b"
+(log-replay) create "c"
+(log-replay) end
+EOF
+pass;
@@ -0,0 +1,21 @@
+/* Calls copy_file_range() with the source positioned past end
+   of file, which must copy nothing and return 0. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  int in, out, byte_cnt;
+
+  CHECK ((in = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK (create ("test.txt", 0), "create \"test.txt\"");
+  CHECK ((out = open ("test.txt")) > 1, "open \"test.txt\"");
+  seek (in, 10000);
+  byte_cnt = copy_file_range (in, out, 100);
+  if (byte_cnt != 0)
+    fail ("copy_file_range() returned %d instead of 0", byte_cnt);
+  CHECK (filesize (out) == 0, "\"test.txt\" is still empty");
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(copy-range-eof) begin
+(copy-range-eof) open "sample.txt"
+(copy-range-eof) create "test.txt"
+(copy-range-eof) open "test.txt"
+(copy-range-eof) "test.txt" is still empty
+(copy-range-eof) end
+copy-range-eof: exit(0)
+EOF
+pass;
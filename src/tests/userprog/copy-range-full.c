@@ -0,0 +1,51 @@
+/* Fills the disk, then copies a file with copy_file_range() the
+   way cp does.  The copy must stop short without reporting an
+   error, so a caller can only tell that it failed by comparing
+   the number of bytes copied against the source's size. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SRC_SIZE 20480
+
+static char buf[512];
+
+void
+test_main (void)
+{
+  int in, out, fill;
+  int copied = 0;
+  int i;
+
+  for (i = 0; i < (int) sizeof buf; i++)
+    buf[i] = i;
+  CHECK (create ("src", 0), "create \"src\"");
+  CHECK ((in = open ("src")) > 1, "open \"src\"");
+  for (i = 0; i < SRC_SIZE / (int) sizeof buf; i++)
+    if (write (in, buf, sizeof buf) != sizeof buf)
+      fail ("write \"src\" failed");
+  seek (in, 0);
+  CHECK (create ("dst", 0), "create \"dst\"");
+  CHECK ((out = open ("dst")) > 1, "open \"dst\"");
+
+  msg ("filling disk...");
+  CHECK (create ("fill", 0), "create \"fill\"");
+  CHECK ((fill = open ("fill")) > 1, "open \"fill\"");
+  while (write (fill, buf, sizeof buf) == sizeof buf)
+    continue;
+  close (fill);
+
+  for (;;)
+    {
+      int bytes_copied = copy_file_range (in, out, 4096);
+      if (bytes_copied == 0)
+        break;
+      if (bytes_copied < 0)
+        fail ("copy_file_range() returned %d", bytes_copied);
+      copied += bytes_copied;
+    }
+  if (copied >= SRC_SIZE)
+    fail ("copied all %d bytes to a full disk", copied);
+  CHECK (filesize (out) == copied, "size of \"dst\" matches bytes copied");
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(copy-range-full) begin
+(copy-range-full) create "src"
+(copy-range-full) open "src"
+(copy-range-full) create "dst"
+(copy-range-full) open "dst"
+(copy-range-full) filling disk...
+(copy-range-full) create "fill"
+(copy-range-full) open "fill"
+(copy-range-full) size of "dst" matches bytes copied
+(copy-range-full) end
+copy-range-full: exit(0)
+EOF
+pass;
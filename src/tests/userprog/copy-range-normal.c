@@ -0,0 +1,28 @@
+/* Copies a file with copy_file_range() and checks the copy and
+   both file positions. */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  int in, out, byte_cnt;
+
+  CHECK ((in = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK (create ("test.txt", 0), "create \"test.txt\"");
+  CHECK ((out = open ("test.txt")) > 1, "open \"test.txt\"");
+  byte_cnt = copy_file_range (in, out, 65536);
+  if (byte_cnt != sizeof sample - 1)
+    fail ("copy_file_range() returned %d instead of %zu",
+          byte_cnt, sizeof sample - 1);
+  if (tell (in) != sizeof sample - 1 || tell (out) != sizeof sample - 1)
+    fail ("file positions are %u and %u instead of %zu",
+          tell (in), tell (out), sizeof sample - 1);
+  msg ("copy \"sample.txt\" to \"test.txt\"");
+  close (out);
+
+  check_file ("test.txt", sample, sizeof sample - 1);
+}
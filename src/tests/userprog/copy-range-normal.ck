@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(copy-range-normal) begin
+(copy-range-normal) open "sample.txt"
+(copy-range-normal) create "test.txt"
+(copy-range-normal) open "test.txt"
+(copy-range-normal) copy "sample.txt" to "test.txt"
+(copy-range-normal) open "test.txt" for verification
+(copy-range-normal) verified contents of "test.txt"
+(copy-range-normal) close "test.txt"
+(copy-range-normal) end
+copy-range-normal: exit(0)
+EOF
+pass;
@@ -0,0 +1,17 @@
+/* Calls copy_file_range() with two fds for the same file, which
+   must fail by returning -1. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  int in, out;
+
+  CHECK ((in = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((out = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK (copy_file_range (in, out, 100) == -1,
+         "copy \"sample.txt\" to itself (must return -1)");
+}
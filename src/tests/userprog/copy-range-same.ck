@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(copy-range-same) begin
+(copy-range-same) open "sample.txt"
+(copy-range-same) open "sample.txt"
+(copy-range-same) copy "sample.txt" to itself (must return -1)
+(copy-range-same) end
+copy-range-same: exit(0)
+EOF
+pass;
@@ -0,0 +1,13 @@
+/* Passes a kernel address to the memstat system call, which
+   must cause the process to be terminated with exit code -1. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  msg ("memstat(0xc0000000): %d", memstat ((struct memstat *) 0xc0000000));
+  fail ("should have exited with -1");
+}
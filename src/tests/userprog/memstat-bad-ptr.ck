@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(memstat-bad-ptr) begin
+memstat-bad-ptr: exit(-1)
+EOF
+pass;
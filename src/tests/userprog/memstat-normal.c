@@ -0,0 +1,29 @@
+/* Touches a number of pages and checks that the memstat system
+   call reports them as resident and accessed. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_CNT 16
+
+static char buf[PAGE_CNT * 4096];
+
+void
+test_main (void)
+{
+  struct memstat ms;
+  size_t i;
+
+  for (i = 0; i < sizeof buf; i += 4096)
+    buf[i] = i / 4096;
+
+  CHECK (memstat (&ms), "memstat");
+  if (ms.resident < PAGE_CNT)
+    fail ("%u pages resident, expected at least %d", ms.resident, PAGE_CNT);
+  if (ms.ws_pages > ms.resident)
+    fail ("working set %u exceeds %u resident pages",
+          ms.ws_pages, ms.resident);
+  if (ms.ws_peak < ms.ws_pages)
+    fail ("working set peak %u below current %u", ms.ws_peak, ms.ws_pages);
+}
@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(memstat-normal) begin
+(memstat-normal) memstat
+(memstat-normal) end
+memstat-normal: exit(0)
+EOF
+pass;
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF', <<'EOF']);
+(pread-bad-ptr) begin
+(pread-bad-ptr) open "sample.txt"
+(pread-bad-ptr) end
+pread-bad-ptr: exit(0)
+EOF
+(pread-bad-ptr) begin
+(pread-bad-ptr) open "sample.txt"
+pread-bad-ptr: exit(-1)
+EOF
+pass;
@@ -0,0 +1,23 @@
+/* Reads with pread() at offsets at and past end of file, which
+   must return 0 bytes. */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  char buf[16];
+  int handle, byte_cnt;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  byte_cnt = pread (handle, buf, sizeof buf, sizeof sample - 1);
+  if (byte_cnt != 0)
+    fail ("pread() at end of file returned %d instead of 0", byte_cnt);
+  byte_cnt = pread (handle, buf, sizeof buf, 10000);
+  if (byte_cnt != 0)
+    fail ("pread() past end of file returned %d instead of 0", byte_cnt);
+  msg ("pread past end of \"sample.txt\"");
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(pread-eof) begin
+(pread-eof) open "sample.txt"
+(pread-eof) pread past end of "sample.txt"
+(pread-eof) end
+pread-eof: exit(0)
+EOF
+pass;
@@ -0,0 +1,25 @@
+/* Reads part of a file with pread() and checks that it returns
+   the right bytes without moving the file position. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  char buf[50];
+  int handle, byte_cnt;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  byte_cnt = pread (handle, buf, sizeof buf, 100);
+  if (byte_cnt != sizeof buf)
+    fail ("pread() returned %d instead of %zu", byte_cnt, sizeof buf);
+  if (memcmp (buf, sample + 100, sizeof buf))
+    fail ("pread() returned the wrong bytes");
+  if (tell (handle) != 0)
+    fail ("pread() moved the file position to %u", tell (handle));
+  msg ("pread \"sample.txt\"");
+}
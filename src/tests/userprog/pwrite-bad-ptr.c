@@ -0,0 +1,16 @@
+/* Passes an invalid pointer to the pwrite system call.
+   The process must be terminated with -1 exit code. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  int handle;
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+
+  pwrite (handle, (char *) 0x10123420, 123, 0);
+  fail ("should not have survived pwrite()");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF', <<'EOF']);
+(pwrite-bad-ptr) begin
+(pwrite-bad-ptr) open "sample.txt"
+(pwrite-bad-ptr) end
+pwrite-bad-ptr: exit(0)
+EOF
+(pwrite-bad-ptr) begin
+(pwrite-bad-ptr) open "sample.txt"
+pwrite-bad-ptr: exit(-1)
+EOF
+pass;
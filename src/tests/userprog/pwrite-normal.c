@@ -0,0 +1,33 @@
+/* Writes with pwrite() at an offset past end of file and checks
+   the file's new size, that the gap reads as zeros and that the
+   file position did not move. */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define OFS 1000
+
+static char buf[OFS + sizeof sample - 1];
+
+void
+test_main (void)
+{
+  int handle, byte_cnt;
+  size_t i;
+
+  CHECK (create ("test.txt", 0), "create \"test.txt\"");
+  CHECK ((handle = open ("test.txt")) > 1, "open \"test.txt\"");
+  byte_cnt = pwrite (handle, sample, sizeof sample - 1, OFS);
+  if (byte_cnt != sizeof sample - 1)
+    fail ("pwrite() returned %d instead of %zu", byte_cnt, sizeof sample - 1);
+  if (tell (handle) != 0)
+    fail ("pwrite() moved the file position to %u", tell (handle));
+  msg ("pwrite \"test.txt\"");
+  close (handle);
+
+  for (i = 0; i < sizeof sample - 1; i++)
+    buf[OFS + i] = sample[i];
+  check_file ("test.txt", buf, sizeof buf);
+}
@@ -0,0 +1,31 @@
+/* Passes readv() and writev() iovec counts that are negative or
+   larger than IOV_MAX, which must fail by returning -1. */
+
+#include <iovec.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[1];
+static struct iovec iov[IOV_MAX + 1];
+
+void
+test_main (void)
+{
+  int handle;
+  int i;
+
+  for (i = 0; i < IOV_MAX + 1; i++)
+    {
+      iov[i].iov_base = buf;
+      iov[i].iov_len = sizeof buf;
+    }
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK (readv (handle, iov, IOV_MAX + 1) == -1,
+         "readv with IOV_MAX + 1 buffers (must return -1)");
+  CHECK (readv (handle, iov, -1) == -1,
+         "readv with -1 buffers (must return -1)");
+  CHECK (writev (handle, iov, IOV_MAX + 1) == -1,
+         "writev with IOV_MAX + 1 buffers (must return -1)");
+  CHECK (tell (handle) == 0, "file position unchanged");
+}
@@ -0,0 +1,19 @@
+/* Passes readv() an iovec whose buffer is an invalid pointer.
+   The process must be terminated with -1 exit code. */
+
+#include <iovec.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  char buf[10];
+  struct iovec iov[2] = {{buf, sizeof buf}, {(char *) 0xc0100000, 123}};
+  int handle;
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+
+  readv (handle, iov, 2);
+  fail ("should not have survived readv()");
+}
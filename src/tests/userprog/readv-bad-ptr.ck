@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF', <<'EOF']);
+(readv-bad-ptr) begin
+(readv-bad-ptr) open "sample.txt"
+(readv-bad-ptr) end
+readv-bad-ptr: exit(0)
+EOF
+(readv-bad-ptr) begin
+(readv-bad-ptr) open "sample.txt"
+readv-bad-ptr: exit(-1)
+EOF
+pass;
@@ -0,0 +1,29 @@
+/* Reads a file into three buffers with one readv(), the last of
+   which extends past end of file, and checks what each buffer
+   received. */
+
+#include <iovec.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  char a[10], b[100], c[200];
+  struct iovec iov[3] = {{a, sizeof a}, {b, sizeof b}, {c, sizeof c}};
+  int handle, byte_cnt;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  byte_cnt = readv (handle, iov, 3);
+  if (byte_cnt != sizeof sample - 1)
+    fail ("readv() returned %d instead of %zu", byte_cnt, sizeof sample - 1);
+  if (memcmp (a, sample, sizeof a)
+      || memcmp (b, sample + sizeof a, sizeof b)
+      || memcmp (c, sample + sizeof a + sizeof b,
+                 sizeof sample - 1 - sizeof a - sizeof b))
+    fail ("readv() returned the wrong bytes");
+  msg ("readv \"sample.txt\"");
+}
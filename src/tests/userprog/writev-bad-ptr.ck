@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF', <<'EOF']);
+(writev-bad-ptr) begin
+(writev-bad-ptr) open "sample.txt"
+(writev-bad-ptr) end
+writev-bad-ptr: exit(0)
+EOF
+(writev-bad-ptr) begin
+(writev-bad-ptr) open "sample.txt"
+writev-bad-ptr: exit(-1)
+EOF
+pass;
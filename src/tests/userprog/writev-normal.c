@@ -0,0 +1,38 @@
+/* Writes a file with one writev() of IOV_MAX buffers, more than
+   the kernel copies in at once, and checks its contents. */
+
+#include <iovec.h>
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static struct iovec iov[IOV_MAX];
+
+void
+test_main (void)
+{
+  size_t size = sizeof sample - 1;
+  size_t ofs = 0;
+  int handle, byte_cnt;
+  int i;
+
+  /* Split SAMPLE into IOV_MAX pieces of varying lengths. */
+  for (i = 0; i < IOV_MAX; i++)
+    {
+      size_t len = i < IOV_MAX - 1 ? (size_t) i % 7 : size - ofs;
+      iov[i].iov_base = sample + ofs;
+      iov[i].iov_len = len;
+      ofs += len;
+    }
+
+  CHECK (create ("test.txt", 0), "create \"test.txt\"");
+  CHECK ((handle = open ("test.txt")) > 1, "open \"test.txt\"");
+  byte_cnt = writev (handle, iov, IOV_MAX);
+  if (byte_cnt != (int) size)
+    fail ("writev() returned %d instead of %zu", byte_cnt, size);
+  msg ("writev \"test.txt\"");
+  close (handle);
+
+  check_file ("test.txt", sample, size);
+}
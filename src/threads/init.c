@@ -34,8 +34,12 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/pci.h"
+#include "devices/ramdisk.h"
+#include "devices/virtio-blk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/log.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -49,6 +53,9 @@ static bool format_filesys;
    overriding the defaults. */
 static const char *filesys_bdev_name;
 static const char *scratch_bdev_name;
+
+/* -ramdisk: Size of RAM disk "rd0" in kB, or 0 for none. */
+static size_t ramdisk_kb;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
@@ -119,10 +126,16 @@ main (void)
   thread_start ();
   serial_init_queue ();
   timer_calibrate ();
+#ifdef USERPROG
+  process_init ();
+#endif
 
 #ifdef FILESYS
   /* Initialize file system. */
+  pci_init ();
   ide_init ();
+  virtio_blk_init ();
+  ramdisk_init (ramdisk_kb);
   locate_block_devices ();
   filesys_init (format_filesys);
 #endif
@@ -247,6 +260,14 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-ramdisk"))
+        ramdisk_kb = atoi (value);
+      else if (!strcmp (name, "-bigdisk"))
+        ide_allow_big_disks = true;
+      else if (!strcmp (name, "-blktrace"))
+        block_trace = true;
+      else if (!strcmp (name, "-logcrash"))
+        log_crash = true;
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -259,6 +280,8 @@ parse_options (char **argv)
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+      else if (!strcmp (name, "-memstat"))
+        memstat_report = true;
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -292,6 +315,15 @@ run_task (char **argv)
   printf ("Execution of '%s' complete.\n", task);
 }
 
+#ifdef FILESYS
+/* Prints the block devices' request traces. */
+static void
+print_block_trace (char **argv UNUSED)
+{
+  block_print_trace ();
+}
+#endif
+
 /* Executes all of the actions specified in ARGV[]
    up to the null pointer sentinel. */
 static void
@@ -315,6 +347,7 @@ run_actions (char **argv)
       {"rm", 2, fsutil_rm},
       {"extract", 1, fsutil_extract},
       {"append", 2, fsutil_append},
+      {"blktrace", 1, print_block_trace},
 #endif
       {NULL, 0, NULL},
     };
@@ -364,6 +397,7 @@ usage (void)
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  extract            Untar from scratch device into file system.\n"
           "  append FILE        Append FILE to tar file on scratch device.\n"
+          "  blktrace           Print recent block requests (needs -blktrace).\n"
 #endif
           "\nOptions:\n"
           "  -h                 Print this help message and power off.\n"
@@ -373,6 +407,11 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -ramdisk=KB        Create KB kB RAM disk rd0, usable as a BDEV.\n"
+          "  -bigdisk           Use IDE disks of 1 GB or more.\n"
+          "  -blktrace          Trace recent requests to each block device.\n"
+          "  -logcrash          Leave the last log transaction unwritten at\n"
+          "                     shutdown, to test recovery.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
@@ -381,6 +420,7 @@ usage (void)
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+          "  -memstat           Print paging statistics at process exit.\n"
 #endif
           );
   shutdown_power_off ();
@@ -43,6 +43,23 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Reader-writer lock. */
+struct rwlock
+  {
+    struct lock lock;           /* Protects the members below. */
+    struct condition readers_ok; /* Signaled when readers may enter. */
+    struct condition writer_ok; /* Signaled when a writer may enter. */
+    int readers;                /* Number of threads reading. */
+    int waiting_writers;        /* Number of threads waiting to write. */
+    bool writer;                /* Held by a writer? */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+
 
 
 bool lock_cmp_priority (struct list_elem *a, struct list_elem *b, void *aux);
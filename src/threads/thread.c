@@ -16,6 +16,9 @@
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
+#ifdef FILESYS
+#include "filesys/directory.h"
+#endif
 
 
 /* Random value for struct thread's `magic' member.
@@ -325,6 +328,12 @@ thread_create (const char *name, int priority,
   list_init(&t->file_table);
 #endif // USERPROG
 
+#ifdef FILESYS
+  /* Children start out in their parent's working directory. */
+  if (thread_current ()->cwd != NULL)
+    t->cwd = dir_reopen (thread_current ()->cwd);
+#endif
+
 
   /* Add to run queue. */
   thread_unblock (t);
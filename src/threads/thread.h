@@ -3,9 +3,12 @@
 
 #include <debug.h>
 #include <list.h>
+#include <memstat.h>
 #include <stdint.h>
 #include "threads/synch.h"
 #include "threads/fixed_point.h"
+
+struct dir;
 /* States in a thread's life cycle. */
 enum thread_status
   {
@@ -124,6 +127,20 @@ struct thread
   bool exited;
   // is parent thread has cadded wait
   bool waited;
+
+  /* Paging statistics, see userprog/exception.c. */
+  struct memstat memstat;
+  struct list_elem sample_elem;       /* Element in process.c's list of
+                                         sampled processes. */
+#endif
+
+#ifdef FILESYS
+  /* Owned by filesys/filesys.c. */
+  struct dir *cwd;                    /* Working directory, or null for
+                                         the root. */
+
+  /* Owned by filesys/log.c. */
+  int log_depth;                      /* Nested log_begin() calls. */
 #endif
 
   /* Owned by thread.c. */
@@ -3,6 +3,7 @@
 #include <stddef.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 
@@ -230,6 +231,49 @@ pagedir_activate (uint32_t *pd)
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (pd)) : "memory");
 }
 
+/* Walks the user portion of PD, storing the number of mapped
+   pages into *RESIDENT and returning how many of them have been
+   accessed since the previous call.  Accessed bits are cleared
+   as they are counted, so each call sees only fresh accesses.
+   PD need not be the active page directory.  Interrupts are
+   turned off while each page table is scanned, so that clearing
+   an accessed bit cannot race with the owning process updating
+   the same entry. */
+size_t
+pagedir_sample_accessed (uint32_t *pd, size_t *resident)
+{
+  uint32_t *pde;
+  size_t accessed = 0;
+
+  ASSERT (pd != init_page_dir);
+
+  *resident = 0;
+  for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
+    if (*pde & PTE_P)
+      {
+        uint32_t *pt = pde_get_pt (*pde);
+        uint32_t *pte;
+        enum intr_level old_level;
+
+        old_level = intr_disable ();
+        for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
+          if (*pte & PTE_P)
+            {
+              (*resident)++;
+              if (*pte & PTE_A)
+                {
+                  *pte &= ~(uint32_t) PTE_A;
+                  accessed++;
+                }
+            }
+        intr_set_level (old_level);
+      }
+
+  if (accessed > 0)
+    invalidate_pagedir (pd);
+  return accessed;
+}
+
 /* Returns the currently active page directory. */
 static uint32_t *
 active_pd (void)
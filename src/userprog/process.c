@@ -11,27 +11,54 @@
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 
 static thread_func start_process NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
 static void extract_command_name(char * cmd_string, char *command_name);
 static void extract_command_args(char * cmd_string, char* argv[], int *argc);
 static struct thread* find_child(tid_t child_tid);
+static thread_func sampler_thread NO_RETURN;
+static void sample_working_set (struct thread *);
+
+bool memstat_report;
+
+/* Processes whose working sets the sampler thread measures, that
+   is, every thread with a page directory.  SAMPLE_LOCK protects
+   the list and keeps a page directory from being destroyed while
+   it is being sampled. */
+static struct list sampled_list;
+static struct lock sample_lock;
 
 struct fd_entry
 {
   int fd;
   struct file *file;
+  /* Non-null if the fd refers to a directory, for readdir(). */
+  struct dir *dir;
   struct list_elem elem;
 };
 
 
+/* Starts the thread that samples user processes' working
+   sets. */
+void
+process_init (void)
+{
+  list_init (&sampled_list);
+  lock_init (&sample_lock);
+  thread_create ("memstat", PRI_DEFAULT, sampler_thread, NULL);
+}
+
 /* Starts a new thread running a user program loaded from
    FILENAME.  The new thread may be scheduled (and may even exit)
    before process_execute() returns.  Returns the new process's
@@ -144,6 +171,15 @@ process_exit (void)
   struct thread *cur = thread_current ();
   uint32_t *pd;
   printf("%s: exit(%d)\n", cur->name, cur->ret);
+  if (memstat_report && cur->pagedir != NULL)
+    {
+      struct memstat *ms = &cur->memstat;
+      lock_acquire (&sample_lock);
+      sample_working_set (cur);
+      lock_release (&sample_lock);
+      printf ("%s: working set %u pages (peak %u), %u resident\n",
+              cur->name, ms->ws_pages, ms->ws_peak, ms->resident);
+    }
   // close open file descriptors;
 
   if (cur->executable != NULL) {
@@ -151,6 +187,8 @@ process_exit (void)
   }
 
   process_close_all();
+  dir_close(cur->cwd);
+  cur->cwd = NULL;
 
   while (!list_empty(&cur->sema_wait.waiters)) {
     sema_up(&cur->sema_wait);
@@ -165,6 +203,10 @@ process_exit (void)
   pd = cur->pagedir;
   if (pd != NULL)
     {
+      lock_acquire (&sample_lock);
+      list_remove (&cur->sample_elem);
+      lock_release (&sample_lock);
+
       /* Correct ordering here is crucial.  We must set
          cur->pagedir to NULL before switching page directories,
          so that a timer interrupt can't switch back to the
@@ -194,6 +236,58 @@ process_activate (void)
   tss_update ();
 }
 
+/* Takes a working-set sample of process T: counts the user
+   pages it has touched since the previous sample, using the
+   accessed bits in its page directory.  The caller must hold
+   SAMPLE_LOCK. */
+static void
+sample_working_set (struct thread *t)
+{
+  struct memstat *ms = &t->memstat;
+  size_t resident;
+
+  ASSERT (lock_held_by_current_thread (&sample_lock));
+
+  ms->ws_pages = pagedir_sample_accessed (t->pagedir, &resident);
+  ms->resident = resident;
+  if (ms->ws_pages > ms->ws_peak)
+    ms->ws_peak = ms->ws_pages;
+}
+
+/* Takes a fresh working-set sample of the current process and
+   stores its paging statistics into *MS. */
+void
+process_memstat (struct memstat *ms)
+{
+  struct thread *cur = thread_current ();
+
+  lock_acquire (&sample_lock);
+  sample_working_set (cur);
+  *ms = cur->memstat;
+  lock_release (&sample_lock);
+}
+
+/* Samples the working set of every user process each
+   MEMSTAT_SAMPLE_TICKS timer ticks.  Walking page directories
+   here rather than in the timer interrupt keeps the walk out of
+   interrupt context; pagedir_sample_accessed() only turns
+   interrupts off for one page table at a time. */
+static void
+sampler_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct list_elem *e;
+
+      timer_sleep (MEMSTAT_SAMPLE_TICKS);
+      lock_acquire (&sample_lock);
+      for (e = list_begin (&sampled_list); e != list_end (&sampled_list);
+           e = list_next (e))
+        sample_working_set (list_entry (e, struct thread, sample_elem));
+      lock_release (&sample_lock);
+    }
+}
+
 /* We load ELF binaries.  The following definitions are taken
    from the ELF specification, [ELF1], more-or-less verbatim.  */
 
@@ -290,6 +384,9 @@ load (const char *file_name, void (**eip) (void), void **esp)
   t->pagedir = pagedir_create ();
   if (t->pagedir == NULL)
     goto done;
+  lock_acquire (&sample_lock);
+  list_push_back (&sampled_list, &t->sample_elem);
+  lock_release (&sample_lock);
   process_activate ();
 
   /* Open executable file. */
@@ -647,6 +744,15 @@ process_open (const char *file_name)
   struct thread* cur = thread_current();
   fd_entry->fd = allocate_fd();
   fd_entry->file = f;
+  fd_entry->dir = NULL;
+  if (inode_is_dir (file_get_inode (f))) {
+    fd_entry->dir = dir_open (inode_reopen (file_get_inode (f)));
+    if (fd_entry->dir == NULL) {
+      file_close (f);
+      free (fd_entry);
+      return -1;
+    }
+  }
   list_push_back(&thread_current()->file_table, &fd_entry->elem);
   return fd_entry->fd;
 }
@@ -658,7 +764,7 @@ process_write(int fd, const void *buffer, unsigned size)
   if (fd == STDOUT_FILENO) {
     putbuf((char *)buffer, (size_t)size);
     return (int)size;
-  } else if (fe != NULL) {
+  } else if (fe != NULL && fe->dir == NULL) {
     return (int)file_write(fe->file, buffer, size);
   }
   return -1;
@@ -671,6 +777,7 @@ process_close (int fd)
   struct fd_entry *fe = get_fd_entry(fd);
   if (fe != NULL) {
     file_close(fe->file);
+    dir_close(fe->dir);
     list_remove(&fe->elem);
     free(fe);
   }
@@ -696,7 +803,7 @@ process_close_all (void)
 int
 process_read (int fd, void *buffer, unsigned size) {
   struct fd_entry* fe = get_fd_entry(fd);
-  if (fe != NULL) {
+  if (fe != NULL && fe->dir == NULL) {
     return file_read(fe->file, buffer, size);
   } else {
     return -1;
@@ -734,6 +841,144 @@ process_seek (int fd, unsigned position)
   }
 }
 
+/* Reads SIZE bytes from file FD at OFFSET into BUFFER, leaving
+   the file position alone.  Returns the number of bytes read, or
+   -1 if FD is not an open file. */
+int
+process_pread (int fd, void *buffer, unsigned size, unsigned offset)
+{
+  struct fd_entry* fe = get_fd_entry(fd);
+  if (fe == NULL || fe->dir != NULL) {
+    return -1;
+  }
+  return file_read_at(fe->file, buffer, size, offset);
+}
+
+/* Writes SIZE bytes from BUFFER to file FD at OFFSET, leaving
+   the file position alone.  Returns the number of bytes written,
+   or -1 if FD is not an open file. */
+int
+process_pwrite (int fd, const void *buffer, unsigned size, unsigned offset)
+{
+  struct fd_entry* fe = get_fd_entry(fd);
+  if (fe == NULL || fe->dir != NULL) {
+    return -1;
+  }
+  return file_write_at(fe->file, buffer, size, offset);
+}
+
+/* Reads from FD into the IOVCNT buffers in IOV in turn, as one
+   read() per buffer would, but looking FD up only once.  Returns
+   the total number of bytes read, or -1 if FD is not an open
+   file. */
+int
+process_readv (int fd, const struct iovec *iov, int iovcnt)
+{
+  struct fd_entry* fe = get_fd_entry(fd);
+  int total = 0;
+  int i;
+  if (fe == NULL || fe->dir != NULL) {
+    return -1;
+  }
+  for (i = 0; i < iovcnt; i++) {
+    off_t n = file_read(fe->file, iov[i].iov_base, iov[i].iov_len);
+    total += n;
+    if ((size_t) n < iov[i].iov_len) {
+      break;
+    }
+  }
+  return total;
+}
+
+/* Writes the IOVCNT buffers in IOV to FD in turn, as one write()
+   per buffer would, but looking FD up only once.  Returns the
+   total number of bytes written, or -1 if FD is not an open file
+   or the console. */
+int
+process_writev (int fd, const struct iovec *iov, int iovcnt)
+{
+  struct fd_entry* fe = get_fd_entry(fd);
+  int total = 0;
+  int i;
+  if (fd == STDOUT_FILENO) {
+    for (i = 0; i < iovcnt; i++) {
+      putbuf(iov[i].iov_base, iov[i].iov_len);
+      total += iov[i].iov_len;
+    }
+    return total;
+  }
+  if (fe == NULL || fe->dir != NULL) {
+    return -1;
+  }
+  for (i = 0; i < iovcnt; i++) {
+    off_t n = file_write(fe->file, iov[i].iov_base, iov[i].iov_len);
+    total += n;
+    if ((size_t) n < iov[i].iov_len) {
+      break;
+    }
+  }
+  return total;
+}
+
+/* Copies up to LENGTH bytes from file FD_IN to file FD_OUT, at
+   and advancing their current positions, without passing the
+   data through user memory.  Returns the number of bytes
+   copied, or -1 if either fd is not an open file, both refer to
+   the same file or the kernel is out of memory. */
+int
+process_copy_file_range (int fd_in, int fd_out, unsigned length)
+{
+  struct fd_entry* in = get_fd_entry(fd_in);
+  struct fd_entry* out = get_fd_entry(fd_out);
+  if (in == NULL || in->dir != NULL || out == NULL || out->dir != NULL) {
+    return -1;
+  }
+  if (length > INT32_MAX) {
+    length = INT32_MAX;
+  }
+  return file_copy(out->file, in->file, length);
+}
+
+/* Reserves LENGTH bytes of space in file FD starting at OFFSET.
+   Returns false if FD is not an open file or the disk is full. */
+bool
+process_fallocate (int fd, unsigned offset, unsigned length)
+{
+  struct fd_entry* fe = get_fd_entry(fd);
+  if (fe == NULL || fe->dir != NULL) {
+    return false;
+  }
+  return file_allocate(fe->file, offset, length);
+}
+
+/* Reads the next entry of directory FD into NAME, which must
+   have room for NAME_MAX + 1 bytes.  Returns false if FD is not a
+   directory or has no more entries. */
+bool
+process_readdir (int fd, char *name)
+{
+  struct fd_entry* fe = get_fd_entry(fd);
+  return fe != NULL && fe->dir != NULL && dir_readdir(fe->dir, name);
+}
+
+bool
+process_isdir (int fd)
+{
+  struct fd_entry* fe = get_fd_entry(fd);
+  return fe != NULL && fe->dir != NULL;
+}
+
+int
+process_inumber (int fd)
+{
+  struct fd_entry* fe = get_fd_entry(fd);
+  if (fe != NULL) {
+    return inode_get_inumber(file_get_inode(fe->file));
+  } else {
+    return -1;
+  }
+}
+
 static struct thread*
 find_child(tid_t child_tid)
 {
@@ -1,16 +1,38 @@
 #ifndef USERPROG_PROCESS_H
 #define USERPROG_PROCESS_H
 
+#include <iovec.h>
 #include "threads/thread.h"
 
 #define CMD_ARGS_DELIMITER " "
 #define CMD_ARGS_MAX 30
 #define CMD_LENGTH_MAX 100
 
+/* Timer ticks between working-set samples of user
+   processes. */
+#define MEMSTAT_SAMPLE_TICKS 100
 
+/* If true, process_exit() prints paging statistics after the
+   exit status line.  Controlled by kernel command-line option
+   "-memstat". */
+extern bool memstat_report;
+
+
+void process_init (void);
 tid_t process_execute (const char *file_name);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
 int process_open (const char *file_name);
+void process_memstat (struct memstat *);
+bool process_readdir (int fd, char *name);
+bool process_isdir (int fd);
+int process_inumber (int fd);
+bool process_fallocate (int fd, unsigned offset, unsigned length);
+int process_pread (int fd, void *buffer, unsigned size, unsigned offset);
+int process_pwrite (int fd, const void *buffer, unsigned size,
+                    unsigned offset);
+int process_readv (int fd, const struct iovec *, int iovcnt);
+int process_writev (int fd, const struct iovec *, int iovcnt);
+int process_copy_file_range (int fd_in, int fd_out, unsigned length);
 #endif /* userprog/process.h */
@@ -8,12 +8,13 @@
 #include "threads/vaddr.h"
 #include "threads/malloc.h"
 #include "kernel/console.h"
+#include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "devices/shutdown.h"
 #include "lib/string.h"
 
-#define MAX_SYSCALL 21
+#define MAX_SYSCALL 27
 #define CODESEG_BASE ((void *) 0x08048000)
 typedef int pid_t;
 
@@ -235,6 +236,245 @@ syscall_close (struct intr_frame *f) {
   return 0;
 }
 
+static int
+syscall_memstat (struct intr_frame *f) {
+  if (!is_valid_pointer(f->esp + 4, 4)) {
+    return -1;
+  }
+  uint8_t *buffer = *(uint8_t **)(f->esp + 4);
+  struct memstat ms;
+  size_t i;
+  process_memstat(&ms);
+  for (i = 0; i < sizeof ms; i++) {
+    if (!put_user(buffer + i, ((uint8_t *) &ms)[i])) {
+      return -1;
+    }
+  }
+  f->eax = true;
+  return 0;
+}
+
+static int
+syscall_chdir (struct intr_frame *f) {
+  if (!is_valid_pointer(f->esp + 4, 4) || !is_valid_string(*(char **)(f->esp + 4))) {
+    return -1;
+  }
+  const char *dir_name = *(char **)(f->esp + 4);
+  f->eax = filesys_chdir(dir_name);
+  return 0;
+}
+
+static int
+syscall_mkdir (struct intr_frame *f) {
+  if (!is_valid_pointer(f->esp + 4, 4) || !is_valid_string(*(char **)(f->esp + 4))) {
+    return -1;
+  }
+  const char *dir_name = *(char **)(f->esp + 4);
+  f->eax = filesys_mkdir(dir_name);
+  return 0;
+}
+
+static int
+syscall_readdir (struct intr_frame *f) {
+  if (!is_valid_pointer(f->esp + 4, 8)) {
+    return -1;
+  }
+  int fd = *(int *)(f->esp + 4);
+  uint8_t *buffer = *(uint8_t **)(f->esp + 8);
+  char name[NAME_MAX + 1];
+  if (!process_readdir(fd, name)) {
+    f->eax = false;
+    return 0;
+  }
+  size_t i;
+  for (i = 0; i <= strlen(name); i++) {
+    if (!put_user(buffer + i, name[i])) {
+      return -1;
+    }
+  }
+  f->eax = true;
+  return 0;
+}
+
+static int
+syscall_isdir (struct intr_frame *f) {
+  if (!is_valid_pointer(f->esp + 4, 4)) {
+    return -1;
+  }
+  int fd = *(int *)(f->esp + 4);
+  f->eax = process_isdir(fd);
+  return 0;
+}
+
+static int
+syscall_inumber (struct intr_frame *f) {
+  if (!is_valid_pointer(f->esp + 4, 4)) {
+    return -1;
+  }
+  int fd = *(int *)(f->esp + 4);
+  f->eax = process_inumber(fd);
+  return 0;
+}
+
+static int
+syscall_fallocate (struct intr_frame *f) {
+  if (!is_valid_pointer(f->esp + 4, 12)) {
+    return -1;
+  }
+  int fd = *(int *)(f->esp + 4);
+  unsigned offset = *(unsigned *)(f->esp + 8);
+  unsigned length = *(unsigned *)(f->esp + 12);
+  f->eax = process_fallocate(fd, offset, length);
+  return 0;
+}
+
+/* Returns true if the SIZE bytes at user address BUFFER can be
+   accessed, checking both ends as syscall_read() does. */
+static bool
+is_valid_buffer (const void *buffer, unsigned size)
+{
+  return is_valid_pointer((void *) buffer, 1)
+         && is_valid_pointer((void *) buffer + size, 1);
+}
+
+static int
+syscall_pread (struct intr_frame *f) {
+  if (!is_valid_pointer(f->esp + 4, 16)) {
+    return -1;
+  }
+  int fd = *(int *)(f->esp + 4);
+  void *buffer = *(char **)(f->esp + 8);
+  unsigned size = *(unsigned *)(f->esp + 12);
+  unsigned offset = *(unsigned *)(f->esp + 16);
+
+  if (!is_valid_buffer(buffer, size)) {
+    return -1;
+  }
+  f->eax = process_pread(fd, buffer, size, offset);
+  return 0;
+}
+
+static int
+syscall_pwrite (struct intr_frame *f) {
+  if (!is_valid_pointer(f->esp + 4, 16)) {
+    return -1;
+  }
+  int fd = *(int *)(f->esp + 4);
+  void *buffer = *(char **)(f->esp + 8);
+  unsigned size = *(unsigned *)(f->esp + 12);
+  unsigned offset = *(unsigned *)(f->esp + 16);
+
+  if (!is_valid_buffer(buffer, size)) {
+    return -1;
+  }
+  f->eax = process_pwrite(fd, buffer, size, offset);
+  return 0;
+}
+
+/* Number of iovecs copied from user memory at a time by
+   readv() and writev(), which bounds their stack use no matter
+   how many buffers the caller passes. */
+#define IOV_BATCH 8
+
+/* Returns true if the IOVCNT-entry iovec array at user address
+   UIOV and every buffer it names can be accessed. */
+static bool
+is_valid_iovec (const struct iovec *uiov, int iovcnt)
+{
+  int i;
+  for (i = 0; i < iovcnt; i++) {
+    if (!is_valid_pointer((void *) &uiov[i], sizeof *uiov)
+        || !is_valid_buffer(uiov[i].iov_base, uiov[i].iov_len)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Does readv() or, if WRITE, writev() on FD with the IOVCNT-entry
+   iovec array at user address UIOV, which is_valid_iovec() has
+   checked, copying it in IOV_BATCH entries at a time.  Stops at
+   the first short transfer.  Returns the total number of bytes
+   moved, or -1 if FD is not an open file. */
+static int
+do_iovec (int fd, const struct iovec *uiov, int iovcnt, bool write)
+{
+  struct iovec iov[IOV_BATCH];
+  int total = 0;
+  int done = 0;
+  do {
+    int cnt = iovcnt - done < IOV_BATCH ? iovcnt - done : IOV_BATCH;
+    size_t wanted = 0;
+    int i, n;
+    for (i = 0; i < cnt; i++) {
+      iov[i] = uiov[done + i];
+      wanted += iov[i].iov_len;
+    }
+    n = write ? process_writev(fd, iov, cnt) : process_readv(fd, iov, cnt);
+    if (n < 0) {
+      return n;
+    }
+    total += n;
+    done += cnt;
+    if ((size_t) n < wanted) {
+      break;
+    }
+  } while (done < iovcnt);
+  return total;
+}
+
+static int
+syscall_readv (struct intr_frame *f) {
+  if (!is_valid_pointer(f->esp + 4, 12)) {
+    return -1;
+  }
+  int fd = *(int *)(f->esp + 4);
+  const struct iovec *uiov = *(struct iovec **)(f->esp + 8);
+  int iovcnt = *(int *)(f->esp + 12);
+
+  if (iovcnt < 0 || iovcnt > IOV_MAX) {
+    f->eax = -1;
+    return 0;
+  }
+  if (!is_valid_iovec(uiov, iovcnt)) {
+    return -1;
+  }
+  f->eax = do_iovec(fd, uiov, iovcnt, false);
+  return 0;
+}
+
+static int
+syscall_writev (struct intr_frame *f) {
+  if (!is_valid_pointer(f->esp + 4, 12)) {
+    return -1;
+  }
+  int fd = *(int *)(f->esp + 4);
+  const struct iovec *uiov = *(struct iovec **)(f->esp + 8);
+  int iovcnt = *(int *)(f->esp + 12);
+
+  if (iovcnt < 0 || iovcnt > IOV_MAX) {
+    f->eax = -1;
+    return 0;
+  }
+  if (!is_valid_iovec(uiov, iovcnt)) {
+    return -1;
+  }
+  f->eax = do_iovec(fd, uiov, iovcnt, true);
+  return 0;
+}
+
+static int
+syscall_copy_file_range (struct intr_frame *f) {
+  if (!is_valid_pointer(f->esp + 4, 12)) {
+    return -1;
+  }
+  int fd_in = *(int *)(f->esp + 4);
+  int fd_out = *(int *)(f->esp + 8);
+  unsigned length = *(unsigned *)(f->esp + 12);
+  f->eax = process_copy_file_range(fd_in, fd_out, length);
+  return 0;
+}
+
 void
 syscall_init (void)
 {
@@ -256,6 +496,18 @@ syscall_init (void)
   syscall_handlers[SYS_SEEK] = &syscall_seek;
   syscall_handlers[SYS_TELL] = &syscall_tell;
   syscall_handlers[SYS_CLOSE] = &syscall_close;
+  syscall_handlers[SYS_CHDIR] = &syscall_chdir;
+  syscall_handlers[SYS_MKDIR] = &syscall_mkdir;
+  syscall_handlers[SYS_READDIR] = &syscall_readdir;
+  syscall_handlers[SYS_ISDIR] = &syscall_isdir;
+  syscall_handlers[SYS_INUMBER] = &syscall_inumber;
+  syscall_handlers[SYS_MEMSTAT] = &syscall_memstat;
+  syscall_handlers[SYS_FALLOCATE] = &syscall_fallocate;
+  syscall_handlers[SYS_PREAD] = &syscall_pread;
+  syscall_handlers[SYS_PWRITE] = &syscall_pwrite;
+  syscall_handlers[SYS_READV] = &syscall_readv;
+  syscall_handlers[SYS_WRITEV] = &syscall_writev;
+  syscall_handlers[SYS_COPY_FILE_RANGE] = &syscall_copy_file_range;
 }
 
 static void